@@ -0,0 +1,42 @@
+# Compiles the GLSL shader stages dumped by the OpenGL backend (see GLContext::SetShaderSourceDumpPath)
+# to SPIR-V for OpenGL (see GLContext::SetSpirvShaderPath).
+# Usage: cmake -DGLSLANG_VALIDATOR=<path> -DINPUT_DIR=<dir> -DOUTPUT_DIR=<dir> -P precompile_spirv.cmake
+
+if(NOT GLSLANG_VALIDATOR OR NOT INPUT_DIR OR NOT OUTPUT_DIR)
+	message(FATAL_ERROR "GLSLANG_VALIDATOR, INPUT_DIR and OUTPUT_DIR have to be specified!")
+endif()
+
+file(MAKE_DIRECTORY "${OUTPUT_DIR}")
+file(GLOB SHADER_FILES "${INPUT_DIR}/*.vert" "${INPUT_DIR}/*.frag" "${INPUT_DIR}/*.geom" "${INPUT_DIR}/*.tesc" "${INPUT_DIR}/*.tese" "${INPUT_DIR}/*.comp")
+
+set(NUM_FAILED 0)
+foreach(SHADER_FILE ${SHADER_FILES})
+	get_filename_component(STAGE_KEY "${SHADER_FILE}" NAME_WE)
+	set(SPIRV_FILE "${OUTPUT_DIR}/${STAGE_KEY}.spv")
+	# The hash of the source code is checked by the backend when loading the SPIR-V, see GLContext::LoadSpirvShaderStages
+	set(HASH_FILE "${INPUT_DIR}/${STAGE_KEY}.hash")
+	if(NOT EXISTS "${HASH_FILE}")
+		message(WARNING "Missing source hash '${HASH_FILE}', skipping '${SHADER_FILE}'.")
+		math(EXPR NUM_FAILED "${NUM_FAILED} + 1")
+		continue()
+	endif()
+	if(EXISTS "${SPIRV_FILE}" AND NOT "${SHADER_FILE}" IS_NEWER_THAN "${SPIRV_FILE}")
+		continue()
+	endif()
+	# -G: SPIR-V for OpenGL, binding points have already been remapped by the backend
+	execute_process(
+		COMMAND "${GLSLANG_VALIDATOR}" -G -o "${SPIRV_FILE}" "${SHADER_FILE}"
+		RESULT_VARIABLE RESULT
+		OUTPUT_VARIABLE OUTPUT
+		ERROR_VARIABLE OUTPUT)
+	if(NOT RESULT EQUAL 0)
+		message(WARNING "Failed to compile '${SHADER_FILE}' to SPIR-V:\n${OUTPUT}")
+		file(REMOVE "${SPIRV_FILE}" "${OUTPUT_DIR}/${STAGE_KEY}.hash")
+		math(EXPR NUM_FAILED "${NUM_FAILED} + 1")
+	else()
+		configure_file("${HASH_FILE}" "${OUTPUT_DIR}/${STAGE_KEY}.hash" COPYONLY)
+	endif()
+endforeach()
+
+list(LENGTH SHADER_FILES NUM_SHADERS)
+message(STATUS "Compiled ${NUM_SHADERS} shader stages to SPIR-V (${NUM_FAILED} failed)")
@@ -0,0 +1,111 @@
+// SPDX-FileCopyrightText: (c) 2020 Silverlan <opensource@pragma-engine.com>
+// SPDX-License-Identifier: MIT
+
+module;
+
+#include "opengl_api.hpp"
+
+module pragma.prosper.opengl;
+
+import :buffer_update_batch;
+import :deletion_queue;
+
+using namespace prosper;
+
+// Keeps the staging ranges aligned for the copies
+static constexpr uint64_t STAGING_ALIGNMENT = 16;
+
+GLStagingBuffer::~GLStagingBuffer() { GLDeletionQueue::Get().Enqueue(GLObjectType::Buffer, m_buffer); }
+uint8_t *GLStagingBuffer::Map(uint64_t size)
+{
+	if(size > m_capacity) {
+		GLDeletionQueue::Get().Enqueue(GLObjectType::Buffer, m_buffer);
+		m_capacity = std::max(size, m_capacity * 2);
+		glCreateBuffers(1, &m_buffer);
+		glNamedBufferData(m_buffer, m_capacity, nullptr, GL_STREAM_DRAW);
+	}
+	return static_cast<uint8_t *>(glMapNamedBufferRange(m_buffer, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT));
+}
+bool GLStagingBuffer::Unmap() { return glUnmapNamedBuffer(m_buffer) == GL_TRUE; }
+
+////////////////
+
+void GLBufferUpdateBatch::Add(GLuint buffer, uint64_t offset, uint64_t size, const void *data)
+{
+	if(size == 0)
+		return;
+	auto dataOffset = m_data.size();
+	m_data.resize(dataOffset + size);
+	std::memcpy(m_data.data() + dataOffset, data, size);
+	m_updates.push_back({buffer, offset, size, dataOffset});
+}
+void GLBufferUpdateBatch::Clear()
+{
+	m_updates.clear();
+	m_data.clear();
+}
+void GLBufferUpdateBatch::UploadDirect() const
+{
+	for(auto &update : m_updates)
+		glNamedBufferSubData(update.buffer, update.offset, update.size, m_data.data() + update.dataOffset);
+}
+bool GLBufferUpdateBatch::Upload(GLStagingBuffer &stagingBuffer)
+{
+	if(m_updates.size() < 2) {
+		// Not worth going through the staging buffer
+		UploadDirect();
+		return true;
+	}
+
+	// Sort by destination, the stable sort keeps the submission order for updates with the same offset
+	m_order.resize(m_updates.size());
+	std::iota(m_order.begin(), m_order.end(), 0);
+	std::stable_sort(m_order.begin(), m_order.end(), [this](uint32_t a, uint32_t b) {
+		auto &ua = m_updates[a];
+		auto &ub = m_updates[b];
+		return (ua.buffer != ub.buffer) ? (ua.buffer < ub.buffer) : (ua.offset < ub.offset);
+	});
+
+	// Merge adjacent and overlapping updates of the same buffer into one range
+	m_ranges.clear();
+	m_rangeIndices.resize(m_updates.size());
+	for(auto idx : m_order) {
+		auto &update = m_updates[idx];
+		if(m_ranges.empty() == false) {
+			auto &range = m_ranges.back();
+			if(range.buffer == update.buffer && update.offset <= range.offset + range.size) {
+				range.size = std::max(range.size, update.offset + update.size - range.offset);
+				m_rangeIndices[idx] = m_ranges.size() - 1;
+				continue;
+			}
+		}
+		m_ranges.push_back({update.buffer, update.offset, update.size, 0});
+		m_rangeIndices[idx] = m_ranges.size() - 1;
+	}
+
+	uint64_t stagingSize = 0;
+	for(auto &range : m_ranges) {
+		range.stagingOffset = stagingSize;
+		stagingSize += (range.size + STAGING_ALIGNMENT - 1) & ~(STAGING_ALIGNMENT - 1);
+	}
+
+	auto *stagingData = stagingBuffer.Map(stagingSize);
+	if(stagingData == nullptr) {
+		UploadDirect();
+		return false;
+	}
+	// Copied in submission order, so later updates overwrite earlier ones where they overlap
+	for(auto i = decltype(m_updates.size()) {0u}; i < m_updates.size(); ++i) {
+		auto &update = m_updates[i];
+		auto &range = m_ranges[m_rangeIndices[i]];
+		std::memcpy(stagingData + range.stagingOffset + (update.offset - range.offset), m_data.data() + update.dataOffset, update.size);
+	}
+	if(stagingBuffer.Unmap() == false) {
+		// The staging contents are undefined if unmapping fails
+		UploadDirect();
+		return false;
+	}
+	for(auto &range : m_ranges)
+		glCopyNamedBufferSubData(stagingBuffer.GetGLBuffer(), range.buffer, range.stagingOffset, range.offset, range.size);
+	return true;
+}
@@ -0,0 +1,59 @@
+// SPDX-FileCopyrightText: (c) 2020 Silverlan <opensource@pragma-engine.com>
+// SPDX-License-Identifier: MIT
+
+module;
+
+#include "opengl_api.hpp"
+
+export module pragma.prosper.opengl:buffer_update_batch;
+
+export import std;
+
+namespace prosper {
+	// Buffer that is re-specified every time it's mapped, so the driver can hand out new storage while
+	// copies from an earlier frame are still reading from the old one.
+	class GLStagingBuffer {
+	  public:
+		~GLStagingBuffer();
+		uint8_t *Map(uint64_t size);
+		bool Unmap();
+		GLuint GetGLBuffer() const { return m_buffer; }
+	  private:
+		GLuint m_buffer = 0;
+		uint64_t m_capacity = 0;
+	};
+
+	// Collects buffer updates so they can be uploaded with one staging copy per contiguous destination range
+	// instead of one glNamedBufferSubData call per update. The data is copied into a single array, so adding
+	// an update doesn't allocate once the batch has grown to its working size.
+	class GLBufferUpdateBatch {
+	  public:
+		void Add(GLuint buffer, uint64_t offset, uint64_t size, const void *data);
+		bool IsEmpty() const { return m_updates.empty(); }
+		// Keeps the allocated memory
+		void Clear();
+		// Updates that overlap are applied in the order they were added
+		bool Upload(GLStagingBuffer &stagingBuffer);
+	  private:
+		struct Update {
+			GLuint buffer = 0;
+			uint64_t offset = 0;
+			uint64_t size = 0;
+			uint64_t dataOffset = 0;
+		};
+		struct Range {
+			GLuint buffer = 0;
+			uint64_t offset = 0;
+			uint64_t size = 0;
+			uint64_t stagingOffset = 0;
+		};
+		void UploadDirect() const;
+
+		std::vector<Update> m_updates;
+		std::vector<uint8_t> m_data;
+		// Scratch memory for Upload
+		std::vector<uint32_t> m_order;
+		std::vector<uint32_t> m_rangeIndices;
+		std::vector<Range> m_ranges;
+	};
+};
@@ -8,6 +8,7 @@ module;
 module pragma.prosper.opengl;
 
 import :buffer.buffer;
+import :deletion_queue;
 
 using namespace prosper;
 
@@ -36,6 +37,9 @@ bool GLBuffer::DoMap(Offset offset, Size size, MapFlags mapFlags, void **optOutM
 		m_mappedOffset = offset;
 		return true;
 	}
+	auto &context = static_cast<GLContext &>(GetContext());
+	if(context.RequiresGLThreadRoundTrip())
+		return context.RunOnGLThread([&]() { return DoMap(offset, size, mapFlags, optOutMappedPtr); });
 	GLbitfield access = 0;
 	auto &createInfo = GetCreateInfo();
 	/*if(pragma::math::is_flag_set(createInfo.memoryFeatures,MemoryFeatureFlags::ReadOnly) == false)
@@ -87,12 +91,19 @@ bool GLBuffer::DoUnmap() const
 		m_mappedOffset = 0;
 		return true;
 	}
+	auto &context = static_cast<GLContext &>(GetContext());
+	if(context.RequiresGLThreadRoundTrip())
+		return context.RunOnGLThread([this]() { return DoUnmap(); });
 	m_mappedPtr = nullptr;
 	return glUnmapNamedBuffer(m_buffer);
 }
 
 bool GLBuffer::DoWrite(Offset offset, Size size, const void *data) const
 {
+	auto &context = static_cast<GLContext &>(GetContext());
+	// Writes to mapped memory don't require the GL context, unless the range has to be validated
+	if((m_mappedPtr == nullptr || context.IsValidationEnabled()) && context.RequiresGLThreadRoundTrip())
+		return context.RunOnGLThread([&]() { return DoWrite(offset, size, data); });
 	ValidateBufferRange(m_mappedOffset + offset, size);
 	if(m_mappedPtr) {
 		memcpy(static_cast<uint8_t *>(m_mappedPtr) + m_mappedOffset + offset, data, size);
@@ -106,6 +117,10 @@ bool GLBuffer::DoWrite(Offset offset, Size size, const void *data) const
 
 bool GLBuffer::DoRead(Offset offset, Size size, void *data) const
 {
+	auto &context = static_cast<GLContext &>(GetContext());
+	// Reads from mapped memory don't require the GL context, unless the range has to be validated
+	if((m_mappedPtr == nullptr || context.IsValidationEnabled()) && context.RequiresGLThreadRoundTrip())
+		return context.RunOnGLThread([&]() { return DoRead(offset, size, data); });
 	ValidateBufferRange(m_mappedOffset + offset, size);
 	if(m_mappedPtr) {
 		memcpy(data, static_cast<uint8_t *>(m_mappedPtr) + m_mappedOffset + offset, size);
@@ -136,6 +151,6 @@ bool GLBuffer::ValidateBufferRange(DeviceSize offset, DeviceSize size) const
 
 GLBuffer::~GLBuffer()
 {
-	if(GetParent() == nullptr && m_buffer != 0)
-		glDeleteBuffers(1, &m_buffer);
+	if(GetParent() == nullptr)
+		GLDeletionQueue::Get().Enqueue(GLObjectType::Buffer, m_buffer);
 }
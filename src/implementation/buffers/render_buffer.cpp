@@ -8,6 +8,7 @@ module;
 module pragma.prosper.opengl;
 
 import :buffer.render_buffer;
+import :deletion_queue;
 
 using namespace prosper;
 
@@ -15,7 +16,7 @@ GLRenderBuffer::GLRenderBuffer(prosper::IPrContext &context, const prosper::Grap
     : IRenderBuffer {context, pipelineCreateInfo, buffers, offsets, indexBufferInfo}, m_vao {std::numeric_limits<decltype(m_vao)>::max()}
 {
 }
-GLRenderBuffer::~GLRenderBuffer() { glDeleteVertexArrays(1, &m_vao); }
+GLRenderBuffer::~GLRenderBuffer() { GLDeletionQueue::Get().Enqueue(GLObjectType::VertexArray, m_vao); }
 GLuint GLRenderBuffer::GetGLVertexArrayObject() const { return m_vao; }
 void GLRenderBuffer::Reload()
 {
@@ -8,7 +8,9 @@ module;
 
 module pragma.prosper.opengl;
 
+import :buffer_update_batch;
 import :command_buffer;
+import :deletion_queue;
 
 static const auto SCISSOR_FLIP_Y = false;
 
@@ -36,16 +38,90 @@ std::unique_ptr<prosper::IShaderPipelineLayout> prosper::GLContext::GetShaderPip
 
 ////////////////
 
-prosper::GLCommandBuffer::~GLCommandBuffer() {}
+prosper::GLCommandBuffer::~GLCommandBuffer() { GLDeletionQueue::Get().Enqueue(m_completionFence); }
 
 bool prosper::GLCommandBuffer::Reset(bool shouldReleaseResources) const
 {
+	m_deferredCommands.clear();
+	if(shouldReleaseResources)
+		m_deferredCommands.shrink_to_fit();
 	return true; // TODO
 }
 bool prosper::GLCommandBuffer::StopRecording() const { return true; }
 
+bool prosper::GLCommandBuffer::ShouldDefer()
+{
+	if(IsRecordingDeferred())
+		return true;
+	FlushBufferUpdateBatch();
+	return false;
+}
+bool prosper::GLCommandBuffer::Defer(Command &&cmd)
+{
+	FlushBufferUpdateBatch();
+	m_deferredCommands.push_back(std::move(cmd));
+	return true;
+}
+std::vector<prosper::GLCommandBuffer::Command> prosper::GLCommandBuffer::TakeDeferredCommands() const
+{
+	m_recordDeferred = false;
+	return std::move(m_deferredCommands);
+}
+void prosper::GLCommandBuffer::BeginBufferUpdateBatch()
+{
+	if(m_bufferUpdateBatch == nullptr)
+		m_bufferUpdateBatch = std::make_unique<GLBufferUpdateBatch>();
+	m_batchBufferUpdates = true;
+}
+void prosper::GLCommandBuffer::FlushBufferUpdateBatch()
+{
+	// Commands other than buffer updates may depend on the updates recorded before them
+	if(m_batchBufferUpdates == false)
+		return;
+	EndBufferUpdateBatch();
+	BeginBufferUpdateBatch();
+}
+bool prosper::GLCommandBuffer::EndBufferUpdateBatch()
+{
+	m_batchBufferUpdates = false;
+	if(m_bufferUpdateBatch->IsEmpty())
+		return true;
+	if(IsRecordingDeferred()) {
+		// One command for the entire batch, the batch is handed over to the GL thread
+		auto batch = std::make_shared<GLBufferUpdateBatch>(std::move(*m_bufferUpdateBatch));
+		m_bufferUpdateBatch->Clear();
+		return Defer([batch = std::move(batch)](GLCommandBuffer &cmd) { return cmd.GetContext().UploadBufferUpdates(*batch); });
+	}
+	auto res = GetContext().UploadBufferUpdates(*m_bufferUpdateBatch);
+	m_bufferUpdateBatch->Clear();
+	return res;
+}
+void prosper::GLCommandBuffer::InsertCompletionFence() const
+{
+	if(m_completionFence)
+		glDeleteSync(m_completionFence);
+	m_completionFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+bool prosper::GLCommandBuffer::WaitForCompletion(uint64_t timeout) const
+{
+	if(m_completionFence == nullptr)
+		return true;
+	auto res = glClientWaitSync(m_completionFence, GL_SYNC_FLUSH_COMMANDS_BIT, timeout);
+	return res == GL_ALREADY_SIGNALED || res == GL_CONDITION_SATISFIED;
+}
+bool prosper::GLCommandBuffer::ReplayDeferredCommands(GLCommandBuffer &cmd) const { return ReplayCommands(m_deferredCommands, cmd); }
+bool prosper::GLCommandBuffer::ReplayCommands(const std::vector<Command> &commands, GLCommandBuffer &cmd)
+{
+	auto success = true;
+	for(auto &f : commands)
+		success = f(cmd) && success;
+	return success;
+}
+
 bool prosper::GLCommandBuffer::RecordBindIndexBuffer(IBuffer &buf, IndexType indexType, DeviceSize offset)
 {
+	if(ShouldDefer())
+		return Defer([&buf, indexType, offset](GLCommandBuffer &cmd) { return cmd.RecordBindIndexBuffer(buf, indexType, offset); });
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buf.GetAPITypeRef<GLBuffer>().GetGLBuffer());
 	m_boundIndexBufferData.indexType = indexType;
 	m_boundIndexBufferData.offset = buf.GetStartOffset() + offset;
@@ -56,6 +132,8 @@ bool prosper::GLCommandBuffer::RecordBindVertexBuffer(const prosper::ShaderGraph
 
 bool prosper::GLCommandBuffer::RecordBindVertexBuffers(const prosper::ShaderGraphics &shader, const std::vector<IBuffer *> &buffers, uint32_t startBinding, const std::vector<DeviceSize> &offsets)
 {
+	if(ShouldDefer())
+		return Defer([&shader, buffers, startBinding, offsets](GLCommandBuffer &cmd) { return cmd.RecordBindVertexBuffers(shader, buffers, startBinding, offsets); });
 	uint32_t pipelineIdx = 0;
 	shader.GetBoundPipeline(*this, pipelineIdx);
 	auto &createInfo = static_cast<const prosper::GraphicsPipelineCreateInfo &>(*shader.GetPipelineCreateInfo(pipelineIdx));
@@ -66,6 +144,8 @@ bool prosper::GLCommandBuffer::RecordBindVertexBuffers(const prosper::ShaderGrap
 }
 bool prosper::GLCommandBuffer::RecordBindRenderBuffer(const IRenderBuffer &renderBuffer)
 {
+	if(ShouldDefer())
+		return Defer([&renderBuffer](GLCommandBuffer &cmd) { return cmd.RecordBindRenderBuffer(renderBuffer); });
 	glBindVertexArray(static_cast<const GLRenderBuffer &>(renderBuffer).GetGLVertexArrayObject());
 	auto *indexBufferInfo = renderBuffer.GetIndexBufferInfo();
 	if(indexBufferInfo) {
@@ -77,12 +157,16 @@ bool prosper::GLCommandBuffer::RecordBindRenderBuffer(const IRenderBuffer &rende
 }
 bool prosper::GLCommandBuffer::RecordDispatchIndirect(prosper::IBuffer &buffer, DeviceSize size)
 {
+	if(ShouldDefer())
+		return Defer([&buffer, size](GLCommandBuffer &cmd) { return cmd.RecordDispatchIndirect(buffer, size); });
 	glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, buffer.GetAPITypeRef<GLBuffer>().GetGLBuffer());
 	glDispatchComputeIndirect(size);
 	return GetContext().CheckResult();
 }
 bool prosper::GLCommandBuffer::RecordDispatch(uint32_t x, uint32_t y, uint32_t z)
 {
+	if(ShouldDefer())
+		return Defer([x, y, z](GLCommandBuffer &cmd) { return cmd.RecordDispatch(x, y, z); });
 	glDispatchCompute(x, y, z);
 	return GetContext().CheckResult();
 }
@@ -110,6 +194,8 @@ bool prosper::GLCommandBuffer::RecordDraw(uint32_t vertCount, uint32_t instanceC
 {
 	if(m_boundPipelineData.shader.expired() || m_boundPipelineData.pipelineId.has_value() == false || m_boundPipelineData.shader->IsGraphicsShader() == false)
 		return false;
+	if(ShouldDefer())
+		return Defer([vertCount, instanceCount, firstVertex, firstInstance](GLCommandBuffer &cmd) { return cmd.RecordDraw(vertCount, instanceCount, firstVertex, firstInstance); });
 	CheckViewportAndScissorBounds();
 	auto &pipelineCreateInfo = *static_cast<prosper::GraphicsPipelineCreateInfo *>(static_cast<ShaderGraphics *>(m_boundPipelineData.shader.get())->GetPipelineCreateInfo(*m_boundPipelineData.shaderPipelineId));
 	auto glTopology = prosper::util::to_opengl_enum(pipelineCreateInfo.GetPrimitiveTopology());
@@ -120,6 +206,8 @@ bool prosper::GLCommandBuffer::RecordDrawIndexed(uint32_t indexCount, uint32_t i
 {
 	if(m_boundPipelineData.shader.expired() || m_boundPipelineData.pipelineId.has_value() == false || m_boundPipelineData.shader->IsGraphicsShader() == false)
 		return false;
+	if(ShouldDefer())
+		return Defer([indexCount, instanceCount, firstIndex, firstInstance](GLCommandBuffer &cmd) { return cmd.RecordDrawIndexed(indexCount, instanceCount, firstIndex, firstInstance); });
 	CheckViewportAndScissorBounds();
 	GetContext().CheckResult();
 	auto &pipelineCreateInfo = *static_cast<prosper::GraphicsPipelineCreateInfo *>(static_cast<ShaderGraphics *>(m_boundPipelineData.shader.get())->GetPipelineCreateInfo(*m_boundPipelineData.shaderPipelineId));
@@ -134,6 +222,8 @@ bool prosper::GLCommandBuffer::RecordDrawIndexed(uint32_t indexCount, uint32_t i
 }
 bool prosper::GLCommandBuffer::RecordDrawIndexedIndirect(IBuffer &buf, DeviceSize offset, uint32_t drawCount, uint32_t stride)
 {
+	if(ShouldDefer())
+		return Defer([&buf, offset, drawCount, stride](GLCommandBuffer &cmd) { return cmd.RecordDrawIndexedIndirect(buf, offset, drawCount, stride); });
 	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, buf.GetAPITypeRef<GLBuffer>().GetGLBuffer());
 	for(uint32_t i = 0; i < drawCount; ++i)
 		glDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, reinterpret_cast<void *>(offset + i * stride));
@@ -142,6 +232,8 @@ bool prosper::GLCommandBuffer::RecordDrawIndexedIndirect(IBuffer &buf, DeviceSiz
 }
 bool prosper::GLCommandBuffer::RecordDrawIndirect(IBuffer &buf, DeviceSize offset, uint32_t count, uint32_t stride)
 {
+	if(ShouldDefer())
+		return Defer([&buf, offset, count, stride](GLCommandBuffer &cmd) { return cmd.RecordDrawIndirect(buf, offset, count, stride); });
 	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, buf.GetAPITypeRef<GLBuffer>().GetGLBuffer());
 	for(uint32_t i = 0; i < count; ++i)
 		glDrawArraysIndirect(GL_TRIANGLES, reinterpret_cast<void *>(offset + i * stride));
@@ -150,6 +242,8 @@ bool prosper::GLCommandBuffer::RecordDrawIndirect(IBuffer &buf, DeviceSize offse
 }
 bool prosper::GLCommandBuffer::RecordFillBuffer(IBuffer &buf, DeviceSize offset, DeviceSize size, uint32_t value)
 {
+	if(ShouldDefer())
+		return Defer([&buf, offset, size, value](GLCommandBuffer &cmd) { return cmd.RecordFillBuffer(buf, offset, size, value); });
 	// TODO: Allow VK_WHOLE_SIZE as size?
 	assert((size % sizeof(uint32_t) == 0));
 	std::vector<uint32_t> vData {};
@@ -161,11 +255,15 @@ bool prosper::GLCommandBuffer::RecordFillBuffer(IBuffer &buf, DeviceSize offset,
 
 bool prosper::GLCommandBuffer::RecordSetBlendConstants(const std::array<float, 4> &blendConstants)
 {
+	if(ShouldDefer())
+		return Defer([blendConstants](GLCommandBuffer &cmd) { return cmd.RecordSetBlendConstants(blendConstants); });
 	glBlendColor(blendConstants[0], blendConstants[1], blendConstants[2], blendConstants[3]);
 	return true;
 }
 bool prosper::GLCommandBuffer::RecordSetDepthBounds(float minDepthBounds, float maxDepthBounds)
 {
+	if(ShouldDefer())
+		return Defer([minDepthBounds, maxDepthBounds](GLCommandBuffer &cmd) { return cmd.RecordSetDepthBounds(minDepthBounds, maxDepthBounds); });
 	// Note: This is not equivalent to Vulkan
 	glDepthRange(minDepthBounds, maxDepthBounds);
 	return true;
@@ -173,6 +271,8 @@ bool prosper::GLCommandBuffer::RecordSetDepthBounds(float minDepthBounds, float
 
 bool prosper::GLCommandBuffer::RecordSetStencilCompareMask(StencilFaceFlags faceMask, uint32_t stencilCompareMask)
 {
+	if(ShouldDefer())
+		return Defer([faceMask, stencilCompareMask](GLCommandBuffer &cmd) { return cmd.RecordSetStencilCompareMask(faceMask, stencilCompareMask); });
 	GLint func, ref;
 
 	if(pragma::math::is_flag_set(faceMask, StencilFaceFlags::FrontBit)) {
@@ -190,6 +290,8 @@ bool prosper::GLCommandBuffer::RecordSetStencilCompareMask(StencilFaceFlags face
 }
 bool prosper::GLCommandBuffer::RecordSetStencilReference(StencilFaceFlags faceMask, uint32_t stencilReference)
 {
+	if(ShouldDefer())
+		return Defer([faceMask, stencilReference](GLCommandBuffer &cmd) { return cmd.RecordSetStencilReference(faceMask, stencilReference); });
 	GLint func, mask;
 	if(pragma::math::is_flag_set(faceMask, StencilFaceFlags::FrontBit)) {
 		glGetIntegerv(GL_STENCIL_FUNC, &func);
@@ -206,6 +308,8 @@ bool prosper::GLCommandBuffer::RecordSetStencilReference(StencilFaceFlags faceMa
 }
 bool prosper::GLCommandBuffer::RecordSetStencilWriteMask(StencilFaceFlags faceMask, uint32_t stencilWriteMask)
 {
+	if(ShouldDefer())
+		return Defer([faceMask, stencilWriteMask](GLCommandBuffer &cmd) { return cmd.RecordSetStencilWriteMask(faceMask, stencilWriteMask); });
 	glStencilMaskSeparate(GL_STENCIL_WRITEMASK, pragma::math::is_flag_set(faceMask, StencilFaceFlags::FrontBit) ? stencilWriteMask : 1);
 	glStencilMaskSeparate(GL_STENCIL_BACK_WRITEMASK, pragma::math::is_flag_set(faceMask, StencilFaceFlags::BackBit) ? stencilWriteMask : 1);
 	return GetContext().CheckResult();
@@ -221,112 +325,225 @@ bool prosper::GLCommandBuffer::RecordPipelineBarrier(const prosper::util::Pipeli
 
 bool prosper::GLCommandBuffer::RecordSetDepthBias(float depthBiasConstantFactor, float depthBiasClamp, float depthBiasSlopeFactor)
 {
+	if(ShouldDefer())
+		return Defer([depthBiasConstantFactor, depthBiasClamp, depthBiasSlopeFactor](GLCommandBuffer &cmd) { return cmd.RecordSetDepthBias(depthBiasConstantFactor, depthBiasClamp, depthBiasSlopeFactor); });
 	glPolygonOffset(depthBiasSlopeFactor, depthBiasConstantFactor);
 	return true;
 }
-static void clear_image(prosper::GLContext &context, prosper::IImage &img, uint32_t layerId, uint32_t layerCount, uint32_t baseMipmap, uint32_t mipmapCount, const std::array<float, 4> &clearColor, std::optional<float> clearDepth, std::optional<float> clearStencil)
+// Fallback for images that aren't backed by a texture (e.g. renderbuffers) or clears that can't be expressed
+// with glClearTexSubImage. This still doesn't bind the framebuffer, but the scissor test and write masks
+// affect glClearNamedFramebuffer*, so they have to be adjusted.
+static void clear_framebuffer(GLuint framebuffer, const prosper::GLImage &img, const std::array<float, 4> &clearColor, std::optional<float> clearDepth, std::optional<uint32_t> clearStencil)
 {
-	GLint drawFboId = 0;
-	glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &drawFboId);
-	pragma::util::ScopeGuard sg {[drawFboId]() {
-		// Restore previous bound framebuffer
-		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, drawFboId);
-	}};
-
-	auto framebuffer = static_cast<prosper::GLImage &>(img).GetOrCreateFramebuffer(layerId, layerCount, baseMipmap, mipmapCount);
-	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, static_cast<prosper::GLFramebuffer &>(*framebuffer).GetGLFramebuffer());
-	if(!clearDepth && !clearStencil) {
-		glDisable(GL_SCISSOR_TEST);
-		glDisable(GL_STENCIL_TEST);
+	glDisable(GL_SCISSOR_TEST);
+	if(!prosper::util::is_depth_format(img.GetFormat())) {
 		glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
-
-		glClearColor(clearColor.at(0), clearColor.at(1), clearColor.at(2), clearColor.at(3));
-		context.CheckResult();
-		glClear(GL_COLOR_BUFFER_BIT);
-		context.CheckResult();
+		// The clear call has to match the format type, otherwise the result is undefined (see GLRenderPass)
+		if(prosper::util::is_integer_pixel_data_format(img.GetPixelDataFormat())) {
+			GLboolean normalized;
+			auto type = prosper::util::to_opengl_image_format_type(img.GetFormat(), normalized);
+			if(type == GL_BYTE || type == GL_SHORT || type == GL_INT) {
+				std::array<GLint, 4> clearColorInt;
+				for(auto i = decltype(clearColor.size()) {0u}; i < clearColor.size(); ++i)
+					clearColorInt[i] = static_cast<GLint>(clearColor[i]);
+				glClearNamedFramebufferiv(framebuffer, GL_COLOR, 0, clearColorInt.data());
+			}
+			else {
+				std::array<GLuint, 4> clearColorUint;
+				for(auto i = decltype(clearColor.size()) {0u}; i < clearColor.size(); ++i)
+					clearColorUint[i] = static_cast<GLuint>(clearColor[i]);
+				glClearNamedFramebufferuiv(framebuffer, GL_COLOR, 0, clearColorUint.data());
+			}
+		}
+		else
+			glClearNamedFramebufferfv(framebuffer, GL_COLOR, 0, clearColor.data());
 		return;
 	}
-
-	glDisable(GL_SCISSOR_TEST);
-	glDisable(GL_STENCIL_TEST);
-
 	if(clearDepth.has_value()) {
-		glDepthMask(GL_TRUE);
 		GLboolean depthWritesEnabled;
 		glGetBooleanv(GL_DEPTH_WRITEMASK, &depthWritesEnabled);
 		glDepthMask(GL_TRUE);
-
-		glClearDepth(*clearDepth);
-		glClear(GL_DEPTH_BUFFER_BIT);
-
+		glClearNamedFramebufferfv(framebuffer, GL_DEPTH, 0, &*clearDepth);
 		glDepthMask(depthWritesEnabled);
 	}
 	if(clearStencil.has_value()) {
-		glStencilMask(GL_TRUE);
-		GLboolean stencilWritesEnabled;
-		glGetBooleanv(GL_STENCIL_WRITEMASK, &stencilWritesEnabled);
-		glStencilMask(GL_TRUE);
+		GLint stencilWriteMask;
+		glGetIntegerv(GL_STENCIL_WRITEMASK, &stencilWriteMask);
+		glStencilMask(std::numeric_limits<GLuint>::max());
+		GLint stencil = *clearStencil;
+		glClearNamedFramebufferiv(framebuffer, GL_STENCIL, 0, &stencil);
+		glStencilMask(stencilWriteMask);
+	}
+}
+static bool clear_image(prosper::GLContext &context, prosper::IImage &img, uint32_t layerId, uint32_t layerCount, uint32_t baseMipmap, uint32_t mipmapCount, const std::array<float, 4> &clearColor, std::optional<float> clearDepth, std::optional<uint32_t> clearStencil)
+{
+	auto &glImg = static_cast<prosper::GLImage &>(img);
+	auto format = img.GetFormat();
+	auto isDepthImage = prosper::util::is_depth_format(format);
+	auto hasStencil = prosper::util::has_stencil_component(format);
+	// Depth-stencil textures can only be cleared as a whole with glClearTexSubImage
+	auto isPartialDepthStencilClear = isDepthImage && hasStencil && (!clearDepth.has_value() || !clearStencil.has_value());
+	auto numImageLayers = img.GetLayerCount();
+	auto numImageMipmaps = img.GetMipmapCount();
+	if(layerId >= numImageLayers || baseMipmap >= numImageMipmaps)
+		return false;
+	layerCount = pragma::math::min(layerCount, numImageLayers - layerId);
+	mipmapCount = pragma::math::min(mipmapCount, numImageMipmaps - baseMipmap);
 
-		glClearStencil(*clearStencil);
-		glClear(GL_STENCIL_BUFFER_BIT);
+	if(glImg.IsSwapchainImage() || glImg.IsRenderbuffer() || isPartialDepthStencilClear) {
+		for(auto mipmap = baseMipmap; mipmap < (baseMipmap + mipmapCount); ++mipmap) {
+			auto framebuffer = glImg.GetOrCreateFramebuffer(layerId, layerCount, mipmap, 1);
+			clear_framebuffer(framebuffer->GetGLFramebuffer(), glImg, clearColor, clearDepth, clearStencil);
+		}
+		return context.CheckResult();
+	}
+	if(prosper::util::is_compressed_format(format)) {
+		context.ValidationCallback(prosper::DebugMessageSeverityFlags::WarningBit, "Attempted to clear image '" + img.GetDebugName() + "' with compressed format, which is not supported!");
+		return false;
+	}
 
-		glStencilMask(stencilWritesEnabled);
+	GLenum dataFormat;
+	GLenum dataType;
+	const void *data;
+	std::array<int32_t, 4> clearColorInt;
+	std::array<uint32_t, 4> clearColorUint;
+	struct {
+		float depth;
+		uint32_t stencil;
+	} depthStencil;
+	if(isDepthImage) {
+		if(hasStencil) {
+			depthStencil.depth = clearDepth.value_or(0.f);
+			depthStencil.stencil = clearStencil.value_or(0);
+			dataFormat = GL_DEPTH_STENCIL;
+			dataType = GL_FLOAT_32_UNSIGNED_INT_24_8_REV;
+			data = &depthStencil;
+		}
+		else {
+			if(!clearDepth.has_value())
+				return true;
+			dataFormat = GL_DEPTH_COMPONENT;
+			dataType = GL_FLOAT;
+			data = &*clearDepth;
+		}
+	}
+	else if(prosper::util::is_integer_pixel_data_format(glImg.GetPixelDataFormat())) {
+		GLboolean normalized;
+		auto type = prosper::util::to_opengl_image_format_type(format, normalized);
+		dataFormat = GL_RGBA_INTEGER;
+		if(type == GL_BYTE || type == GL_SHORT || type == GL_INT) {
+			for(auto i = decltype(clearColor.size()) {0u}; i < clearColor.size(); ++i)
+				clearColorInt[i] = static_cast<int32_t>(clearColor[i]);
+			dataType = GL_INT;
+			data = clearColorInt.data();
+		}
+		else {
+			for(auto i = decltype(clearColor.size()) {0u}; i < clearColor.size(); ++i)
+				clearColorUint[i] = static_cast<uint32_t>(clearColor[i]);
+			dataType = GL_UNSIGNED_INT;
+			data = clearColorUint.data();
+		}
 	}
+	else {
+		dataFormat = GL_RGBA;
+		dataType = GL_FLOAT;
+		data = clearColor.data();
+	}
+
+	auto texture = glImg.GetGLImage();
+	auto type = glImg.GetImageType();
+	for(auto mipmap = baseMipmap; mipmap < (baseMipmap + mipmapCount); ++mipmap) {
+		auto w = img.GetWidth(mipmap);
+		auto h = img.GetHeight(mipmap);
+		switch(type) {
+		case GL_TEXTURE_1D:
+		case GL_TEXTURE_2D:
+		case GL_TEXTURE_2D_MULTISAMPLE:
+			glClearTexSubImage(texture, mipmap, 0, 0, 0, w, h, 1, dataFormat, dataType, data);
+			break;
+		case GL_TEXTURE_1D_ARRAY:
+			// Layers of 1D array textures are addressed by the y-coordinate
+			glClearTexSubImage(texture, mipmap, 0, layerId, 0, w, layerCount, 1, dataFormat, dataType, data);
+			break;
+		case GL_TEXTURE_3D:
+			glClearTexImage(texture, mipmap, dataFormat, dataType, data);
+			break;
+		default:
+			glClearTexSubImage(texture, mipmap, 0, 0, layerId, w, h, layerCount, dataFormat, dataType, data);
+			break;
+		}
+	}
+	return context.CheckResult();
 }
 bool prosper::GLCommandBuffer::RecordClearImage(IImage &img, ImageLayout layout, const std::array<float, 4> &clearColor, const prosper::util::ClearImageInfo &clearImageInfo)
 {
 	if(IsPrimary() == false)
 		return false;
-	clear_image(GetContext(), img, clearImageInfo.subresourceRange.baseArrayLayer, clearImageInfo.subresourceRange.layerCount, clearImageInfo.subresourceRange.baseMipLevel, clearImageInfo.subresourceRange.levelCount, clearColor, 0.f, false);
-	return GetContext().CheckResult();
-#if 0
-	auto vClearColor = Vector4{clearColor.at(0),clearColor.at(1),clearColor.at(2),clearColor.at(3)};
-	std::vector<Vector4> data {};
-	for(auto i=clearImageInfo.subresourceRange.baseMipLevel;i<(clearImageInfo.subresourceRange.baseMipLevel +clearImageInfo.subresourceRange.levelCount);++i)
-	{
-		// TODO: This is *very* inefficient, how can we handle this better?
-		auto w = img.GetWidth(i);
-		auto h = img.GetHeight(i);
-		data.resize(w *h);
-		std::fill(data.begin(),data.end(),vClearColor);
-		glClearTexSubImage(
-			static_cast<GLImage&>(img).GetGLImage(),clearImageInfo.subresourceRange.baseMipLevel,0,0,clearImageInfo.subresourceRange.baseArrayLayer,
-			w,h,clearImageInfo.subresourceRange.layerCount,GL_RGBA,GL_FLOAT,data.data()
-		);
-	}
-	return GetContext().CheckResult();
-#endif
+	if(ShouldDefer())
+		return Defer([&img, layout, clearColor, clearImageInfo](GLCommandBuffer &cmd) { return cmd.RecordClearImage(img, layout, clearColor, clearImageInfo); });
+	auto &range = clearImageInfo.subresourceRange;
+	return clear_image(GetContext(), img, range.baseArrayLayer, range.layerCount, range.baseMipLevel, range.levelCount, clearColor, {}, {});
 }
 bool prosper::GLCommandBuffer::RecordClearImage(IImage &img, ImageLayout layout, std::optional<float> clearDepth, std::optional<uint32_t> clearStencil, const util::ClearImageInfo &clearImageInfo)
 {
 	if(IsPrimary() == false)
 		return false;
-	clear_image(GetContext(), img, clearImageInfo.subresourceRange.baseArrayLayer, clearImageInfo.subresourceRange.layerCount, clearImageInfo.subresourceRange.baseMipLevel, clearImageInfo.subresourceRange.levelCount, {}, clearDepth, clearStencil);
-	return GetContext().CheckResult();
+	if(ShouldDefer())
+		return Defer([&img, layout, clearDepth, clearStencil, clearImageInfo](GLCommandBuffer &cmd) { return cmd.RecordClearImage(img, layout, clearDepth, clearStencil, clearImageInfo); });
+	auto &range = clearImageInfo.subresourceRange;
+	return clear_image(GetContext(), img, range.baseArrayLayer, range.layerCount, range.baseMipLevel, range.levelCount, {}, clearDepth, clearStencil);
 }
 bool prosper::GLCommandBuffer::RecordClearAttachment(IImage &img, const std::array<float, 4> &clearColor, uint32_t attId, uint32_t layerId, uint32_t layerCount)
 {
 	if(IsPrimary() == false)
 		return false;
-	clear_image(GetContext(), img, layerId, layerCount, 0, std::numeric_limits<uint32_t>::max(), clearColor, {}, {});
-	return GetContext().CheckResult();
+	if(ShouldDefer())
+		return Defer([&img, clearColor, attId, layerId, layerCount](GLCommandBuffer &cmd) { return cmd.RecordClearAttachment(img, clearColor, attId, layerId, layerCount); });
+	return clear_image(GetContext(), img, layerId, layerCount, 0, 1, clearColor, {}, {});
 }
 bool prosper::GLCommandBuffer::RecordClearAttachment(IImage &img, std::optional<float> clearDepth, std::optional<uint32_t> clearStencil, uint32_t layerId)
 {
 	if(IsPrimary() == false)
 		return false;
-	clear_image(GetContext(), img, layerId, 1, 0, std::numeric_limits<uint32_t>::max(), {}, clearDepth, clearStencil);
-	return GetContext().CheckResult();
+	if(ShouldDefer())
+		return Defer([&img, clearDepth, clearStencil, layerId](GLCommandBuffer &cmd) { return cmd.RecordClearAttachment(img, clearDepth, clearStencil, layerId); });
+	return clear_image(GetContext(), img, layerId, 1, 0, 1, {}, clearDepth, clearStencil);
 }
 bool prosper::GLCommandBuffer::RecordUpdateBuffer(IBuffer &buffer, uint64_t offset, uint64_t size, const void *data)
 {
+	if(m_batchBufferUpdates) {
+		auto &glBuffer = buffer.GetAPITypeRef<GLBuffer>();
+		m_bufferUpdateBatch->Add(glBuffer.GetGLBuffer(), glBuffer.GetStartOffset() + offset, size, data);
+		return true;
+	}
+	if(IsRecordingDeferred()) {
+		// The data may no longer be valid by the time the command is replayed
+		std::vector<uint8_t> dataCopy(static_cast<const uint8_t *>(data), static_cast<const uint8_t *>(data) + size);
+		return Defer([&buffer, offset, dataCopy = std::move(dataCopy)](GLCommandBuffer &cmd) { return cmd.RecordUpdateBuffer(buffer, offset, dataCopy.size(), dataCopy.data()); });
+	}
 	auto &glBuffer = buffer.GetAPITypeRef<GLBuffer>();
 	glNamedBufferSubData(glBuffer.GetGLBuffer(), glBuffer.GetStartOffset() + offset, size, data);
 	return GetContext().CheckResult();
 }
 
+static GLuint get_gl_texture(prosper::GLContext &context, prosper::Texture &tex, const std::optional<uint32_t> &layer)
+{
+	// The image view may select a single layer, a mipmap range or a different format,
+	// in which case it is backed by a texture view
+	const auto &imgView = layer.has_value() ? tex.GetImageView(*layer) : tex.GetImageView();
+	if(imgView)
+		return static_cast<const prosper::GLImageView &>(*imgView).GetGLTexture();
+	if(layer.has_value() && context.IsValidationEnabled())
+		context.ValidationCallback(prosper::DebugMessageSeverityFlags::WarningBit, "Attempted to bind layer " + pragma::util::to_string(*layer) + " of texture '" + tex.GetDebugName() + "', but texture has no image view for that layer! Binding entire image instead...");
+	return static_cast<prosper::GLImage &>(tex.GetImage()).GetGLImage();
+}
+
 bool prosper::GLCommandBuffer::RecordBindDescriptorSets(PipelineBindPoint bindPoint, prosper::Shader &shader, PipelineID shaderPipelineId, uint32_t firstSet, const std::vector<prosper::IDescriptorSet *> &descSets, const std::vector<uint32_t> dynamicOffsets)
 {
+	if(ShouldDefer()) {
+		// The bindings are resolved on replay, so changes to the descriptor sets before submission are picked up like in Vulkan
+		return Defer([bindPoint, &shader, shaderPipelineId, firstSet, descSets, dynamicOffsets](GLCommandBuffer &cmd) { return cmd.RecordBindDescriptorSets(bindPoint, shader, shaderPipelineId, firstSet, descSets, dynamicOffsets); });
+	}
 	PipelineID pipelineId;
 	if(shader.GetPipelineId(pipelineId, shaderPipelineId) == false)
 		return false;
@@ -355,10 +572,8 @@ bool prosper::GLCommandBuffer::RecordBindDescriptorSets(PipelineBindPoint bindPo
 				{
 					std::optional<uint32_t> layer {};
 					auto *tex = ds->GetBoundTexture(j, &layer);
-					if(layer.has_value() && GetContext().IsValidationEnabled())
-						GetContext().ValidationCallback(DebugMessageSeverityFlags::WarningBit, "Attempted to bind layer " + pragma::util::to_string(*layer) + " of texture '" + tex->GetDebugName() + "'! This is not allowed in OpenGL!");
 					uint32_t activeTextureSlot = *bindingPoint;
-					glBindTextureUnit(activeTextureSlot, tex ? static_cast<GLImage &>(tex->GetImage()).GetGLImage() : 0);
+					glBindTextureUnit(activeTextureSlot, tex ? get_gl_texture(context, *tex, layer) : 0);
 					auto *sampler = tex ? tex->GetSampler() : nullptr;
 					glBindSampler(activeTextureSlot, sampler ? static_cast<GLSampler &>(*sampler).GetGLSampler() : 0);
 					break;
@@ -369,7 +584,7 @@ bool prosper::GLCommandBuffer::RecordBindDescriptorSets(PipelineBindPoint bindPo
 					for(auto i = decltype(numTextures) {0u}; i < numTextures; ++i) {
 						auto *tex = ds->GetBoundArrayTexture(j, i);
 						uint32_t activeTextureSlot = *bindingPoint + i;
-						glBindTextureUnit(activeTextureSlot, tex ? static_cast<GLImage &>(tex->GetImage()).GetGLImage() : 0);
+						glBindTextureUnit(activeTextureSlot, tex ? get_gl_texture(context, *tex, {}) : 0);
 						auto *sampler = tex ? tex->GetSampler() : nullptr;
 						glBindSampler(activeTextureSlot, sampler ? static_cast<GLSampler &>(*sampler).GetGLSampler() : 0);
 					}
@@ -400,6 +615,10 @@ bool prosper::GLCommandBuffer::RecordBindDescriptorSets(PipelineBindPoint bindPo
 
 bool prosper::GLCommandBuffer::RecordPushConstants(prosper::Shader &shader, PipelineID pipelineId, ShaderStageFlags stageFlags, uint32_t offset, uint32_t size, const void *data)
 {
+	if(ShouldDefer()) {
+		std::vector<uint8_t> dataCopy(static_cast<const uint8_t *>(data), static_cast<const uint8_t *>(data) + size);
+		return Defer([&shader, pipelineId, stageFlags, offset, dataCopy = std::move(dataCopy)](GLCommandBuffer &cmd) { return cmd.RecordPushConstants(shader, pipelineId, stageFlags, offset, dataCopy.size(), dataCopy.data()); });
+	}
 	// Push constants are small in size and usually don't change between render calls, so we
 	// make sure the new data is actually different from what we already have (and if it's not, we can just skip the
 	// update altogether).
@@ -454,6 +673,14 @@ bool prosper::GLCommandBuffer::RecordPushConstants(const IShaderPipelineLayout &
 void prosper::GLCommandBuffer::ClearBoundPipeline()
 {
 	ICommandBuffer::ClearBoundPipeline();
+	if(ShouldDefer()) {
+		m_boundPipelineData = {};
+		Defer([](GLCommandBuffer &cmd) {
+			cmd.ClearBoundPipeline();
+			return true;
+		});
+		return;
+	}
 	glBindVertexArray(0);
 	auto numVertexAttribBindings = m_boundPipelineData.numVertexAttribBindings;
 	for(auto i = decltype(numVertexAttribBindings) {0u}; i < numVertexAttribBindings; ++i)
@@ -468,138 +695,66 @@ std::optional<prosper::PipelineID> prosper::GLCommandBuffer::GetBoundPipelineId(
 prosper::Shader *prosper::GLCommandBuffer::GetBoundShader() const { return m_boundPipelineData.shader.get(); }
 bool prosper::GLCommandBuffer::DoRecordBindShaderPipeline(prosper::Shader &shader, PipelineID shaderPipelineId, PipelineID pipelineId)
 {
+	if(ShouldDefer()) {
+		// The pipeline is only tracked here so draw calls can be validated while recording,
+		// linking and state changes happen on replay
+		m_boundPipelineData.pipelineId = pipelineId;
+		m_boundPipelineData.shader = shader.GetHandle();
+		m_boundPipelineData.shaderPipelineId = shaderPipelineId;
+		// If the bind fails on replay, the command buffer it's replayed into rejects the subsequent draws (see below)
+		return Defer([&shader, shaderPipelineId, pipelineId](GLCommandBuffer &cmd) { return cmd.DoRecordBindShaderPipeline(shader, shaderPipelineId, pipelineId); });
+	}
+	// If the bind fails, no pipeline is bound, so subsequent draws are rejected instead of using the previous pipeline
+	auto failBind = [this]() {
+		m_boundPipelineData.pipelineId = {};
+		m_boundPipelineData.shader = {};
+		m_boundPipelineData.shaderPipelineId = {};
+		GetContext().UseProgram(0);
+		return false;
+	};
+	// Pipelines that are still being linked are skipped instead of stalling
+	std::string infoLog;
+	if(GetContext().PreparePipelineForBind(pipelineId, &infoLog) == false) {
+		// Pipelines that have failed to link are reported by their first bind
+		if(infoLog.empty() == false)
+			GetContext().ValidationCallback(prosper::DebugMessageSeverityFlags::ErrorBit, "Failed to bind pipeline of shader '" + shader.GetIdentifier() + "': " + infoLog);
+		return failBind();
+	}
 	auto program = GetContext().GetPipelineProgram(pipelineId);
 	if(program.has_value() == false)
-		return false;
-	glUseProgram(*program);
+		return failBind();
+	GetContext().UseProgram(*program);
 
 	if(shader.IsGraphicsShader()) {
-		auto *createInfo = static_cast<prosper::GraphicsPipelineCreateInfo *>(shader.GetPipelineCreateInfo(shaderPipelineId));
-		if(createInfo == nullptr)
-			return false;
-		bool blendingEnabled;
-		prosper::BlendOp blendOpColor, blendOpAlpha;
-		prosper::BlendFactor srcColorBlendFactor, dstColorBlendFactor, srcAlphaBlendFactor, dstAlphaBlendFactor;
-		prosper::ColorComponentFlags channelWriteMask;
-		auto res = createInfo->GetColorBlendAttachmentProperties(0 /* sub-pass id */, &blendingEnabled, &blendOpColor, &blendOpAlpha, &srcColorBlendFactor, &dstColorBlendFactor, &srcAlphaBlendFactor, &dstAlphaBlendFactor, &channelWriteMask);
-		if(res && blendingEnabled) {
-			glEnable(GL_BLEND);
-			glBlendEquationSeparate(util::to_opengl_enum(blendOpColor), util::to_opengl_enum(blendOpAlpha));
-			glBlendFuncSeparate(util::to_opengl_enum(srcColorBlendFactor), util::to_opengl_enum(dstColorBlendFactor), util::to_opengl_enum(srcAlphaBlendFactor), util::to_opengl_enum(dstAlphaBlendFactor));
-			glColorMask(pragma::math::is_flag_set(channelWriteMask, prosper::ColorComponentFlags::RBit), pragma::math::is_flag_set(channelWriteMask, prosper::ColorComponentFlags::GBit), pragma::math::is_flag_set(channelWriteMask, prosper::ColorComponentFlags::BBit),
-			  pragma::math::is_flag_set(channelWriteMask, prosper::ColorComponentFlags::ABit));
-		}
-		else
-			glDisable(GL_BLEND);
-
-		prosper::PolygonMode polygonMode;
-		prosper::CullModeFlags cullModeFlags;
-		prosper::FrontFace frontFace;
-		float lineWidth;
-		createInfo->GetRasterizationProperties(&polygonMode, &cullModeFlags, &frontFace, &lineWidth);
-		switch(cullModeFlags) {
-		case prosper::CullModeFlags::FrontAndBack:
-			glEnable(GL_CULL_FACE);
-			glCullFace(GL_FRONT_AND_BACK);
-			break;
-		case prosper::CullModeFlags::BackBit:
-			glEnable(GL_CULL_FACE);
-			glCullFace(GL_FRONT);
-			break;
-		case prosper::CullModeFlags::FrontBit:
-			glEnable(GL_CULL_FACE);
-			glCullFace(GL_BACK);
-			break;
-		default:
-			glDisable(GL_CULL_FACE);
-			break;
-		}
-		switch(frontFace) {
-		case prosper::FrontFace::Clockwise:
-			glFrontFace(GL_CW);
-			break;
-		case prosper::FrontFace::CounterClockwise:
-			glFrontFace(GL_CCW);
-			break;
-		}
-		glLineWidth(lineWidth);
-
-		auto useScissor = false;
-		auto numDynamicScissors = createInfo->GetDynamicScissorBoxesCount();
-		if(numDynamicScissors > 0) {
-			glEnable(GL_SCISSOR_TEST);
-			useScissor = true;
-		}
-		else {
-			int32_t scissorX, scissorY;
-			uint32_t scissorW, scissorH;
-			if(createInfo->GetScissorBoxesCount() > 0 && createInfo->GetScissorBoxProperties(0, &scissorX, &scissorY, &scissorW, &scissorH)) {
-				glEnable(GL_SCISSOR_TEST);
-				useScissor = true;
-				SetScissor(scissorX, scissorY, scissorW, scissorH);
-			}
-			else
-				glDisable(GL_SCISSOR_TEST);
-		}
-
-		auto isDepthBiasEnabled = false;
-		createInfo->GetDepthBiasState(&isDepthBiasEnabled, nullptr, nullptr, nullptr);
-		if(isDepthBiasEnabled)
-			glEnable(GL_POLYGON_OFFSET_FILL);
-		else
-			glDisable(GL_POLYGON_OFFSET_FILL);
-
-		auto customViewport = false;
-		auto numDynamicViewports = createInfo->GetDynamicViewportsCount();
-		if(numDynamicViewports == 0) {
-			float viewportX, viewportY, viewportW, viewportH;
-			float minDepth, maxDepth;
-			if(createInfo->GetViewportCount() > 0 && createInfo->GetViewportProperties(0, &viewportX, &viewportY, &viewportW, &viewportH, &minDepth, &maxDepth)) {
-				customViewport = true;
-				SetViewport(viewportX, viewportY, viewportW, viewportH);
-				glDepthRangef(minDepth, maxDepth);
-			}
-		}
-		else
-			customViewport = true;
-
-		if(customViewport == false) {
-			GLint viewportDims;
-			glGetIntegerv(GL_MAX_VIEWPORT_DIMS, &viewportDims); // TODO: Query this at context creation time
-			SetViewport(0, 0, viewportDims, viewportDims);
-			glDepthRangef(0.f, 1.f);
-		}
+		// The state is resolved once when the pipeline is baked
+		auto *state = GetContext().GetPipelineState(pipelineId);
+		if(state == nullptr)
+			return failBind();
+		GetContext().ApplyPipelineState(*state);
+		if(state->scissor)
+			SetScissor((*state->scissor)[0], (*state->scissor)[1], (*state->scissor)[2], (*state->scissor)[3]);
+		if(state->viewport)
+			SetViewport((*state->viewport)[0], (*state->viewport)[1], (*state->viewport)[2], (*state->viewport)[3]);
 		// ApplyViewport();
 		// if(useScissor)
 		// 	ApplyScissor(); // Scissor has to be applied AFTER viewport!
-
-		bool isDepthTestEnabled;
-		prosper::CompareOp depthCompareOp;
-		createInfo->GetDepthTestState(&isDepthTestEnabled, &depthCompareOp);
-		if(isDepthTestEnabled) {
-			glEnable(GL_DEPTH_TEST);
-			glDepthFunc(util::to_opengl_enum(depthCompareOp));
-		}
-		else
-			glDisable(GL_DEPTH_TEST);
-
-		glDepthMask(createInfo->AreDepthWritesEnabled() ? GL_TRUE : GL_FALSE);
 	}
 
 	auto &buf = GetContext().GetPushConstantBuffer();
 	// TODO
 	//static_assert(false,"Bind push constant buffer");
-	auto result = GetContext().CheckResult();
-	if(result) {
-		m_boundPipelineData.pipelineId = pipelineId;
-		m_boundPipelineData.shader = shader.GetHandle();
-		m_boundPipelineData.shaderPipelineId = shaderPipelineId;
-	}
-	return result;
+	if(GetContext().CheckResult() == false)
+		return failBind();
+	m_boundPipelineData.pipelineId = pipelineId;
+	m_boundPipelineData.shader = shader.GetHandle();
+	m_boundPipelineData.shaderPipelineId = shaderPipelineId;
+	return true;
 }
 
 bool prosper::GLCommandBuffer::RecordSetLineWidth(float lineWidth)
 {
+	if(ShouldDefer())
+		return Defer([lineWidth](GLCommandBuffer &cmd) { return cmd.RecordSetLineWidth(lineWidth); });
 	glLineWidth(lineWidth);
 	return GetContext().CheckResult();
 }
@@ -633,6 +788,8 @@ void prosper::GLCommandBuffer::ApplyScissor()
 }
 bool prosper::GLCommandBuffer::RecordSetViewport(uint32_t width, uint32_t height, uint32_t x, uint32_t y, float minDepth, float maxDepth)
 {
+	if(ShouldDefer())
+		return Defer([width, height, x, y, minDepth, maxDepth](GLCommandBuffer &cmd) { return cmd.RecordSetViewport(width, height, x, y, minDepth, maxDepth); });
 	GLint vpX = x;
 	GLint vpY = y;
 	GLint vpW = width;
@@ -643,6 +800,8 @@ bool prosper::GLCommandBuffer::RecordSetViewport(uint32_t width, uint32_t height
 }
 bool prosper::GLCommandBuffer::RecordSetScissor(uint32_t width, uint32_t height, uint32_t x, uint32_t y)
 {
+	if(ShouldDefer())
+		return Defer([width, height, x, y](GLCommandBuffer &cmd) { return cmd.RecordSetScissor(width, height, x, y); });
 	GLint scX = x;
 	GLint scY = y;
 	GLint scW = width;
@@ -681,11 +840,34 @@ bool prosper::GLCommandBuffer::ResetQuery(const Query &query) const
 	return false; // TODO
 }
 
+bool prosper::GLCommandBuffer::RecordSignalEvent(GLEvent &ev)
+{
+	if(ShouldDefer()) {
+		// The event must not appear set until the commands before it have been executed.
+		// Resetting it doesn't issue any GL calls, so this is safe on the recording thread.
+		ev.Reset();
+		return Defer([&ev](GLCommandBuffer &cmd) { return cmd.RecordSignalEvent(ev); });
+	}
+	ev.Signal();
+	return GetContext().CheckResult();
+}
 bool prosper::GLCommandBuffer::RecordPresentImage(IImage &img, IImage &swapchainImg, IFramebuffer &swapchainFramebuffer)
 {
-	//glBlitNamedFramebuffer(static_cast<GLImage &>(img).GetOrCreateFramebuffer(0, 1, 0, 1)->GetGLFramebuffer(), static_cast<GLFramebuffer &>(swapchainFramebuffer).GetGLFramebuffer(), 0, 0, img.GetWidth(), img.GetHeight(), 0, 0, swapchainImg.GetWidth(), swapchainImg.GetHeight(),
-	//  GL_COLOR_BUFFER_BIT, GL_LINEAR);
+	if(ShouldDefer())
+		return Defer([&img, &swapchainImg, &swapchainFramebuffer](GLCommandBuffer &cmd) { return cmd.RecordPresentImage(img, swapchainImg, swapchainFramebuffer); });
 	auto &context = static_cast<prosper::GLContext &>(GetContext());
+	if(context.IsClipControlEnabled()) {
+		// The image only has to be flipped vertically, which a blit can do without a full-screen pass
+		auto srcW = img.GetWidth();
+		auto srcH = img.GetHeight();
+		auto dstW = swapchainImg.GetWidth();
+		auto dstH = swapchainImg.GetHeight();
+		auto filter = (srcW == dstW && srcH == dstH) ? GL_NEAREST : GL_LINEAR;
+		glDisable(GL_SCISSOR_TEST);
+		glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+		glBlitNamedFramebuffer(static_cast<GLImage &>(img).GetOrCreateFramebuffer(0, 1, 0, 1)->GetGLFramebuffer(), static_cast<GLFramebuffer &>(swapchainFramebuffer).GetGLFramebuffer(), 0, 0, srcW, srcH, 0, dstH, dstW, 0, GL_COLOR_BUFFER_BIT, filter);
+		return context.CheckResult();
+	}
 	auto *shaderFlip = context.GetFlipShader();
 	if(shaderFlip == nullptr)
 		return false;
@@ -713,11 +895,15 @@ prosper::GLContext &prosper::GLCommandBuffer::GetContext() const { return static
 prosper::GLCommandBuffer::GLCommandBuffer(IPrContext &context, prosper::QueueFamilyType queueFamilyType) : ICommandBuffer {context, queueFamilyType} {}
 bool prosper::GLCommandBuffer::DoRecordCopyBuffer(const prosper::util::BufferCopy &copyInfo, IBuffer &bufferSrc, IBuffer &bufferDst)
 {
+	if(ShouldDefer())
+		return Defer([copyInfo, &bufferSrc, &bufferDst](GLCommandBuffer &cmd) { return cmd.DoRecordCopyBuffer(copyInfo, bufferSrc, bufferDst); });
 	glCopyNamedBufferSubData(bufferSrc.GetAPITypeRef<GLBuffer>().GetGLBuffer(), bufferDst.GetAPITypeRef<GLBuffer>().GetGLBuffer(), copyInfo.srcOffset, copyInfo.dstOffset, copyInfo.size);
 	return GetContext().CheckResult();
 }
 bool prosper::GLCommandBuffer::DoRecordCopyImage(const prosper::util::CopyInfo &copyInfo, IImage &imgSrc, IImage &imgDst, uint32_t w, uint32_t h)
 {
+	if(ShouldDefer())
+		return Defer([copyInfo, &imgSrc, &imgDst, w, h](GLCommandBuffer &cmd) { return cmd.DoRecordCopyImage(copyInfo, imgSrc, imgDst, w, h); });
 	util::BlitInfo blitInfo {};
 	blitInfo.extentsSrc = prosper::Extent2D {};
 	blitInfo.extentsSrc->width = w;
@@ -744,6 +930,8 @@ bool prosper::GLCommandBuffer::DoRecordCopyImage(const prosper::util::CopyInfo &
 
 bool prosper::GLCommandBuffer::DoRecordCopyBufferToImage(const prosper::util::BufferImageCopyInfo &copyInfo, IBuffer &bufferSrc, IImage &imgDst)
 {
+	if(ShouldDefer())
+		return Defer([copyInfo, &bufferSrc, &imgDst](GLCommandBuffer &cmd) { return cmd.DoRecordCopyBufferToImage(copyInfo, bufferSrc, imgDst); });
 	static std::vector<uint8_t> imgData {};
 	imgData.clear();
 	auto &glImgDst = static_cast<GLImage &>(imgDst);
@@ -775,6 +963,8 @@ bool prosper::GLCommandBuffer::DoRecordCopyBufferToImage(const prosper::util::Bu
 }
 bool prosper::GLCommandBuffer::DoRecordCopyImageToBuffer(const prosper::util::BufferImageCopyInfo &copyInfo, IImage &imgSrc, ImageLayout srcImageLayout, IBuffer &bufferDst)
 {
+	if(ShouldDefer())
+		return Defer([copyInfo, &imgSrc, srcImageLayout, &bufferDst](GLCommandBuffer &cmd) { return cmd.DoRecordCopyImageToBuffer(copyInfo, imgSrc, srcImageLayout, bufferDst); });
 	auto &glImgDst = static_cast<GLImage &>(imgSrc);
 	auto format = imgSrc.GetFormat();
 
@@ -806,6 +996,8 @@ bool prosper::GLCommandBuffer::DoRecordCopyImageToBuffer(const prosper::util::Bu
 }
 bool prosper::GLCommandBuffer::DoRecordBlitImage(const util::BlitInfo &blitInfo, IImage &imgSrc, IImage &imgDst, const std::array<Offset3D, 2> &srcOffsets, const std::array<Offset3D, 2> &dstOffsets, std::optional<prosper::ImageAspectFlags> aspectFlags)
 {
+	if(ShouldDefer())
+		return Defer([blitInfo, &imgSrc, &imgDst, srcOffsets, dstOffsets, aspectFlags](GLCommandBuffer &cmd) { return cmd.DoRecordBlitImage(blitInfo, imgSrc, imgDst, srcOffsets, dstOffsets, aspectFlags); });
 	if(util::is_compressed_format(imgDst.GetFormat()) || IsPrimary() == false)
 		return false; // Can't blit into a compressed format
 	auto framebufferDst = static_cast<GLImage &>(imgDst).GetOrCreateFramebuffer(blitInfo.dstSubresourceLayer.baseArrayLayer, blitInfo.dstSubresourceLayer.layerCount, blitInfo.dstSubresourceLayer.mipLevel, 1);
@@ -846,8 +1038,34 @@ bool prosper::GLCommandBuffer::DoRecordBlitImage(const util::BlitInfo &blitInfo,
 }
 bool prosper::GLCommandBuffer::DoRecordResolveImage(IImage &imgSrc, IImage &imgDst, const prosper::util::ImageResolve &resolve)
 {
+	if(ShouldDefer())
+		return Defer([&imgSrc, &imgDst, resolve](GLCommandBuffer &cmd) { return cmd.DoRecordResolveImage(imgSrc, imgDst, resolve); });
+	if(IsPrimary() == false)
+		return false;
+	auto &glImgSrc = static_cast<GLImage &>(imgSrc);
+	auto &glImgDst = static_cast<GLImage &>(imgDst);
+	auto &srcRes = resolve.srcSubresource;
+	auto &dstRes = resolve.dstSubresource;
+	auto framebufferSrc = glImgSrc.GetOrCreateFramebuffer(srcRes.baseArrayLayer, srcRes.layerCount, srcRes.mipLevel, 1);
+	auto framebufferDst = glImgDst.GetOrCreateFramebuffer(dstRes.baseArrayLayer, dstRes.layerCount, dstRes.mipLevel, 1);
 
-	return false; // TODO
+	// Blitting from a multisampled framebuffer resolves the samples.
+	// The scissor test affects the blit, so it has to be disabled.
+	glDisable(GL_SCISSOR_TEST);
+	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+	auto &srcOffset = resolve.srcOffset;
+	auto &dstOffset = resolve.dstOffset;
+	auto &extent = resolve.extent;
+	glBlitNamedFramebuffer(framebufferSrc->GetGLFramebuffer(), framebufferDst->GetGLFramebuffer(), srcOffset.x, srcOffset.y, srcOffset.x + extent.width, srcOffset.y + extent.height, dstOffset.x, dstOffset.y, dstOffset.x + extent.width, dstOffset.y + extent.height,
+	  glImgSrc.GetBufferBit(), GL_NEAREST);
+
+	if(glImgSrc.ShouldInvalidateAfterResolve()) {
+		// The multisampled contents are not needed anymore, which allows the driver to discard them
+		// instead of writing them back to memory
+		GLenum attachment = util::is_depth_format(glImgSrc.GetFormat()) ? GL_DEPTH_ATTACHMENT : GL_COLOR_ATTACHMENT0;
+		glInvalidateNamedFramebufferData(framebufferSrc->GetGLFramebuffer(), 1, &attachment);
+	}
+	return GetContext().CheckResult();
 }
 
 ///////////////////
@@ -870,44 +1088,72 @@ bool prosper::GLPrimaryCommandBuffer::IsPrimary() const { return true; }
 prosper::GLPrimaryCommandBuffer::GLPrimaryCommandBuffer(IPrContext &context, prosper::QueueFamilyType queueFamilyType) : GLCommandBuffer {context, queueFamilyType}, ICommandBuffer {context, queueFamilyType} { m_apiTypePtr = this; }
 bool prosper::GLPrimaryCommandBuffer::DoRecordBeginRenderPass(prosper::IImage &img, prosper::IRenderPass &rp, prosper::IFramebuffer &fb, uint32_t *layerId, const std::vector<prosper::ClearValue> &clearValues, RenderPassFlags renderPassFlags)
 {
-	glBindFramebuffer(GL_FRAMEBUFFER, static_cast<GLFramebuffer &>(fb).GetGLFramebuffer());
+	if(ShouldDefer()) {
+		auto optLayerId = layerId ? std::optional<uint32_t> {*layerId} : std::optional<uint32_t> {};
+		return Defer([&img, &rp, &fb, optLayerId, clearValues, renderPassFlags](GLCommandBuffer &cmd) mutable {
+			return static_cast<GLPrimaryCommandBuffer &>(cmd).DoRecordBeginRenderPass(img, rp, fb, optLayerId ? &*optLayerId : nullptr, clearValues, renderPassFlags);
+		});
+	}
+	auto &glRp = static_cast<GLRenderPass &>(rp);
+	auto &glFb = static_cast<GLFramebuffer &>(fb);
+	glBindFramebuffer(GL_FRAMEBUFFER, glFb.GetGLFramebuffer());
 	auto &rpCreateInfo = rp.GetCreateInfo();
 	for(auto attId = decltype(rpCreateInfo.attachments.size()) {0u}; attId < rpCreateInfo.attachments.size(); ++attId) {
-		auto &attInfo = rpCreateInfo.attachments.at(attId);
-		if(attInfo.loadOp != prosper::AttachmentLoadOp::Clear)
-			continue;
 		auto *imgView = fb.GetAttachment(attId);
 		if(imgView == nullptr)
 			return false;
-		auto &attImg = imgView->GetImage();
-		auto &clearVal = clearValues.at(attId);
-		if(util::is_depth_format(attImg.GetFormat())) {
-			if(layerId)
-				RecordClearAttachment(attImg, clearVal.depthStencil.depth, *layerId);
-			else
-				RecordClearAttachment(attImg, clearVal.depthStencil.depth, {});
-		}
-		else {
-			auto &clearCol = clearVal.color.float32;
-			if(layerId)
-				RecordClearAttachment(attImg, std::array<float, 4> {clearCol[0], clearCol[1], clearCol[2], clearCol[3]}, attId, *layerId, 1);
-			else
-				RecordClearAttachment(attImg, std::array<float, 4> {clearCol[0], clearCol[1], clearCol[2], clearCol[3]}, attId, 0u, 1);
+		auto &glAttImg = static_cast<GLImage &>(imgView->GetImage());
+		if(glAttImg.IsMultisampled()) {
+			// Multisampled attachments are resolved after the render pass, so the store op can only be applied once
+			// the resolve has happened. This would discard all layers, so it's skipped if only a single layer is rendered.
+			glAttImg.SetInvalidateAfterResolve(layerId == nullptr && rpCreateInfo.attachments.at(attId).storeOp == prosper::AttachmentStoreOp::DontCare);
 		}
 	}
+	m_activeRenderPass = &glRp;
+	m_activeFramebuffer = &glFb;
+	m_activeLayerId = layerId ? *layerId : std::optional<uint32_t> {};
+	// The framebuffer has all layers attached, so the load ops for a specific layer have to go through the images directly
+	if(layerId)
+		glRp.RecordLoadOps(glFb, clearValues, *layerId);
+	else
+		glRp.RecordLoadOps(glFb, clearValues);
 	return dynamic_cast<GLContext &>(IPrimaryCommandBuffer::GetContext()).CheckResult();
 }
-bool prosper::GLPrimaryCommandBuffer::StartRecording(bool oneTimeSubmit, bool simultaneousUseAllowed) const { return IPrimaryCommandBuffer::StartRecording(oneTimeSubmit, simultaneousUseAllowed); }
+bool prosper::GLPrimaryCommandBuffer::StartRecording(bool oneTimeSubmit, bool simultaneousUseAllowed) const
+{
+	// With threaded submission the commands are executed on the GL thread when the command buffer is submitted
+	m_recordDeferred = GLCommandBuffer::GetContext().IsThreadedSubmissionEnabled();
+	// The previous submission is no longer relevant, the fence may be in use on the GL thread
+	GLDeletionQueue::Get().Enqueue(m_completionFence);
+	m_completionFence = nullptr;
+	return IPrimaryCommandBuffer::StartRecording(oneTimeSubmit, simultaneousUseAllowed);
+}
 bool prosper::GLPrimaryCommandBuffer::DoRecordEndRenderPass()
 {
-	//glBindFramebuffer(GL_FRAMEBUFFER,0);
-	//return dynamic_cast<GLContext&>(IPrimaryCommandBuffer::GetContext()).CheckResult();
-	return true;
+	if(ShouldDefer())
+		return Defer([](GLCommandBuffer &cmd) { return static_cast<GLPrimaryCommandBuffer &>(cmd).DoRecordEndRenderPass(); });
+	if(m_activeRenderPass && m_activeFramebuffer) {
+		if(m_activeLayerId)
+			m_activeRenderPass->RecordStoreOps(*m_activeFramebuffer, *m_activeLayerId);
+		else
+			m_activeRenderPass->RecordStoreOps(*m_activeFramebuffer);
+	}
+	m_activeRenderPass = nullptr;
+	m_activeFramebuffer = nullptr;
+	m_activeLayerId = {};
+	return dynamic_cast<GLContext &>(IPrimaryCommandBuffer::GetContext()).CheckResult();
 }
 bool prosper::GLPrimaryCommandBuffer::RecordNextSubPass()
 {
 	return false; // TODO
 }
+bool prosper::GLPrimaryCommandBuffer::ExecuteCommands(prosper::ISecondaryCommandBuffer &cmdBuf)
+{
+	auto &glCmdBuf = static_cast<GLSecondaryCommandBuffer &>(cmdBuf);
+	if(ShouldDefer())
+		return Defer([&glCmdBuf](GLCommandBuffer &cmd) { return glCmdBuf.ReplayDeferredCommands(cmd); });
+	return glCmdBuf.ReplayDeferredCommands(*this);
+}
 
 std::shared_ptr<prosper::GLSecondaryCommandBuffer> prosper::GLSecondaryCommandBuffer::Create(IPrContext &context, prosper::QueueFamilyType queueFamilyType)
 {
@@ -916,4 +1162,9 @@ std::shared_ptr<prosper::GLSecondaryCommandBuffer> prosper::GLSecondaryCommandBu
 	return cmdBuf;
 }
 bool prosper::GLSecondaryCommandBuffer::IsSecondary() const { return true; }
-prosper::GLSecondaryCommandBuffer::GLSecondaryCommandBuffer(IPrContext &context, prosper::QueueFamilyType queueFamilyType) : GLCommandBuffer {context, queueFamilyType}, ICommandBuffer {context, queueFamilyType}, ISecondaryCommandBuffer {context, queueFamilyType} { m_apiTypePtr = this; }
+prosper::GLSecondaryCommandBuffer::GLSecondaryCommandBuffer(IPrContext &context, prosper::QueueFamilyType queueFamilyType) : GLCommandBuffer {context, queueFamilyType}, ICommandBuffer {context, queueFamilyType}, ISecondaryCommandBuffer {context, queueFamilyType}
+{
+	m_apiTypePtr = this;
+	// Secondary command buffers don't issue any GL calls, see GLPrimaryCommandBuffer::ExecuteCommands
+	m_recordDeferred = true;
+}
@@ -8,84 +8,224 @@ module;
 
 module pragma.prosper.opengl;
 
+import :buffer_update_batch;
 import :context;
+import :deletion_queue;
+import :gl_thread;
 import :shader.post_processing;
+import :shader.program_cache;
+import :shader.usage_profile;
 
 import pragma.platform;
 
+// KHR_parallel_shader_compile is not part of the glad loader
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+using PFNGLMAXSHADERCOMPILERTHREADSKHRPROC = void(APIENTRYP)(GLuint count);
+
 struct GLShaderStage;
 class GLShaderProgram {
   public:
+	enum class Status : uint8_t {
+		Pending = 0,
+		Linked,
+		Failed,
+	};
 	static std::shared_ptr<GLShaderProgram> Create();
 	~GLShaderProgram();
-	void AttachShader(GLShaderStage &shaderStage);
 	GLuint GetProgramId() const;
-	bool Link(std::string &outErr);
+	Status GetStatus() const { return m_status; }
+
+	// Starts linking the program without waiting for the result
+	void SubmitLink(std::vector<std::shared_ptr<GLShaderStage>> stages, const std::optional<uint64_t> &programCacheKey);
+	// Without parallel shader compilation the status queries block, so the link is always considered complete
+	bool IsLinkComplete(bool parallelShaderCompile) const;
+	// Waits for the link to complete (if it hasn't yet) and retrieves the result.
+	// On success the program binary is added to the program cache.
+	Status FinalizeLink(prosper::GLProgramCache *programCache, std::string &outErr);
+
+	// Initializes the program from a binary retrieved with GetBinary. Returns false if the binary was rejected by the driver.
+	bool LoadBinary(GLenum format, const void *data, size_t size);
+	bool GetBinary(GLenum &outFormat, std::vector<uint8_t> &outData) const;
   private:
 	GLShaderProgram(GLuint program);
 	GLuint m_program;
+	Status m_status = Status::Pending;
+	// Stages are kept alive until the link has completed, so their info logs can be retrieved on failure
+	std::vector<std::shared_ptr<GLShaderStage>> m_pendingStages;
+	std::optional<uint64_t> m_programCacheKey {};
 };
 
 struct GLShaderStage : public prosper::ShaderStageProgram {
   public:
+	// Compiles the stage and waits for the result
 	static std::unique_ptr<GLShaderStage> Compile(prosper::ShaderStage stage, const std::string &glslCode, std::string &outErr);
+	// Starts compiling the stage without waiting for the result, errors are reported once the program is linked
+	static std::unique_ptr<GLShaderStage> Submit(prosper::ShaderStage stage, const std::string &glslCode, std::string &outErr);
+	// Creates the stage without compiling it. This is used if a program binary is available,
+	// in which case the stage only has to be compiled if the binary is rejected.
+	static std::unique_ptr<GLShaderStage> CreateDeferred(prosper::ShaderStage stage, std::string glslCode);
+	// Creates the stage from a SPIR-V module. The module is specialized separately for every pipeline, see Specialize.
+	static std::unique_ptr<GLShaderStage> CreateFromSpirv(prosper::ShaderStage stage, std::vector<uint8_t> spirv);
 	~GLShaderStage();
+	prosper::ShaderStage GetStage() const { return m_stage; }
+	bool IsSpirv() const { return m_spirv.empty() == false; }
+	std::unique_ptr<GLShaderStage> Specialize(const std::vector<GLuint> &constantIds, const std::vector<GLuint> &constantValues, std::string &outErr) const;
+
+	// GLSL code with specialization constants kept, see prosper::util::specialize_glsl
+	void SetSpecializationTemplate(std::string glslCode) { m_specializationTemplate = std::move(glslCode); }
+	bool HasSpecializationConstants() const { return m_specializationTemplate.empty() == false; }
+	// Returns the GLSL stage specialized with the specified constants. Variants are cached by their key and
+	// are only compiled once the program is linked.
+	std::shared_ptr<GLShaderStage> GetVariant(const std::vector<GLuint> &constantIds, const std::vector<GLuint> &constantValues, uint64_t variantKey);
 	GLuint GetShaderId() const;
+	bool IsSubmitted() const { return m_shader != 0; }
+	void EnsureSubmitted();
+	bool CheckCompileStatus(std::string &outErr);
+
+	// Hash of the stage type and code. Stages with identical content are shared between shaders, and programs
+	// are shared between pipelines with identical stages.
+	void SetContentKey(uint64_t key) { m_contentKey = key; }
+	const std::optional<uint64_t> &GetContentKey() const { return m_contentKey; }
+
+	// Stages of reloaded shaders are compiled and linked synchronously, so errors are reported by the reload
+	void SetSynchronous(bool synchronous) { m_synchronous = synchronous; }
+	bool IsSynchronous() const { return m_synchronous; }
   private:
-	GLShaderStage(GLuint shader);
-	GLuint m_shader;
+	GLShaderStage(prosper::ShaderStage stage, GLuint shader);
+	prosper::ShaderStage m_stage;
+	GLuint m_shader = 0;
+	std::string m_deferredGlslCode;
+	std::vector<uint8_t> m_spirv;
+	std::string m_specializationTemplate;
+	std::unordered_map<uint64_t, std::shared_ptr<GLShaderStage>> m_variants;
+	std::optional<uint64_t> m_contentKey {};
+	bool m_synchronous = false;
 };
 
-std::unique_ptr<GLShaderStage> GLShaderStage::Compile(prosper::ShaderStage stage, const std::string &glslCode, std::string &outErr)
+static std::optional<GLenum> get_gl_shader_stage(prosper::ShaderStage stage)
 {
-	GLenum glShaderStage;
 	switch(stage) {
 	case prosper::ShaderStage::Compute:
-		glShaderStage = GL_COMPUTE_SHADER;
-		break;
+		return GL_COMPUTE_SHADER;
 	case prosper::ShaderStage::Fragment:
-		glShaderStage = GL_FRAGMENT_SHADER;
-		break;
+		return GL_FRAGMENT_SHADER;
 	case prosper::ShaderStage::Geometry:
-		glShaderStage = GL_GEOMETRY_SHADER;
-		break;
+		return GL_GEOMETRY_SHADER;
 	case prosper::ShaderStage::TessellationControl:
-		glShaderStage = GL_TESS_CONTROL_SHADER;
-		break;
+		return GL_TESS_CONTROL_SHADER;
 	case prosper::ShaderStage::TessellationEvaluation:
-		glShaderStage = GL_TESS_EVALUATION_SHADER;
-		break;
+		return GL_TESS_EVALUATION_SHADER;
 	case prosper::ShaderStage::Vertex:
-		glShaderStage = GL_VERTEX_SHADER;
-		break;
-	default:
-	case prosper::ShaderStage::Unknown:
-		outErr = "Unknown shader stage";
-		return nullptr;
+		return GL_VERTEX_SHADER;
 	}
-	auto shader = glCreateShader(glShaderStage);
+	return {};
+}
 
+static GLuint submit_shader(GLenum glShaderStage, const std::string &glslCode)
+{
+	auto shader = glCreateShader(glShaderStage);
 	auto *pShaderCode = glslCode.c_str();
 	glShaderSource(shader, 1, &pShaderCode, nullptr);
 	glCompileShader(shader);
+	return shader;
+}
 
+std::unique_ptr<GLShaderStage> GLShaderStage::Compile(prosper::ShaderStage stage, const std::string &glslCode, std::string &outErr)
+{
+	auto shaderStage = Submit(stage, glslCode, outErr);
+	if(shaderStage == nullptr || shaderStage->CheckCompileStatus(outErr) == false)
+		return nullptr;
+	return shaderStage;
+}
+
+std::unique_ptr<GLShaderStage> GLShaderStage::Submit(prosper::ShaderStage stage, const std::string &glslCode, std::string &outErr)
+{
+	auto glShaderStage = get_gl_shader_stage(stage);
+	if(!glShaderStage) {
+		outErr = "Unknown shader stage";
+		return nullptr;
+	}
+	return std::unique_ptr<GLShaderStage> {new GLShaderStage {stage, submit_shader(*glShaderStage, glslCode)}};
+}
+
+std::unique_ptr<GLShaderStage> GLShaderStage::CreateDeferred(prosper::ShaderStage stage, std::string glslCode)
+{
+	auto shaderStage = std::unique_ptr<GLShaderStage> {new GLShaderStage {stage, 0}};
+	shaderStage->m_deferredGlslCode = std::move(glslCode);
+	return shaderStage;
+}
+
+std::unique_ptr<GLShaderStage> GLShaderStage::CreateFromSpirv(prosper::ShaderStage stage, std::vector<uint8_t> spirv)
+{
+	auto shaderStage = std::unique_ptr<GLShaderStage> {new GLShaderStage {stage, 0}};
+	shaderStage->m_spirv = std::move(spirv);
+	return shaderStage;
+}
+
+std::unique_ptr<GLShaderStage> GLShaderStage::Specialize(const std::vector<GLuint> &constantIds, const std::vector<GLuint> &constantValues, std::string &outErr) const
+{
+	auto glShaderStage = get_gl_shader_stage(m_stage);
+	if(!glShaderStage) {
+		outErr = "Unknown shader stage";
+		return nullptr;
+	}
+	auto shader = glCreateShader(*glShaderStage);
+	glShaderBinary(1, &shader, GL_SHADER_BINARY_FORMAT_SPIR_V, m_spirv.data(), m_spirv.size());
+	glSpecializeShader(shader, "main", constantIds.size(), constantIds.data(), constantValues.data());
+	auto specializedStage = std::unique_ptr<GLShaderStage> {new GLShaderStage {m_stage, shader}};
+	if(specializedStage->CheckCompileStatus(outErr) == false)
+		return nullptr;
+	return specializedStage;
+}
+
+std::shared_ptr<GLShaderStage> GLShaderStage::GetVariant(const std::vector<GLuint> &constantIds, const std::vector<GLuint> &constantValues, uint64_t variantKey)
+{
+	auto it = m_variants.find(variantKey);
+	if(it != m_variants.end())
+		return it->second;
+	std::shared_ptr<GLShaderStage> variant = CreateDeferred(m_stage, prosper::util::specialize_glsl(m_specializationTemplate, constantIds, constantValues));
+	m_variants[variantKey] = variant;
+	return variant;
+}
+
+void GLShaderStage::EnsureSubmitted()
+{
+	if(IsSubmitted() || IsSpirv())
+		return;
+	auto glShaderStage = get_gl_shader_stage(m_stage);
+	if(!glShaderStage)
+		return;
+	m_shader = submit_shader(*glShaderStage, m_deferredGlslCode);
+	m_deferredGlslCode = {};
+}
+
+bool GLShaderStage::CheckCompileStatus(std::string &outErr)
+{
+	EnsureSubmitted();
+	if(m_shader == 0) {
+		outErr = "Unknown shader stage";
+		return false;
+	}
+	// Blocks until the compilation has completed
 	GLint compileStatus;
-	glGetShaderiv(shader, GL_COMPILE_STATUS, &compileStatus);
+	glGetShaderiv(m_shader, GL_COMPILE_STATUS, &compileStatus);
 	if(compileStatus == GL_FALSE) {
 		GLsizei len;
-		glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &len);
+		glGetShaderiv(m_shader, GL_INFO_LOG_LENGTH, &len);
 		std::vector<GLchar> vInfoLog;
 		vInfoLog.resize(len);
-		glGetShaderInfoLog(shader, len, nullptr, vInfoLog.data());
+		glGetShaderInfoLog(m_shader, len, nullptr, vInfoLog.data());
 
 		outErr = std::string {vInfoLog.data()};
-		return nullptr;
+		return false;
 	}
-	return std::unique_ptr<GLShaderStage> {new GLShaderStage {shader}};
+	return true;
 }
 
-GLShaderStage::GLShaderStage(GLuint shader) : m_shader {shader} {}
-GLShaderStage::~GLShaderStage() { glDeleteShader(m_shader); }
+GLShaderStage::GLShaderStage(prosper::ShaderStage stage, GLuint shader) : m_stage {stage}, m_shader {shader} {}
+GLShaderStage::~GLShaderStage() { prosper::GLDeletionQueue::Get().Enqueue(prosper::GLObjectType::Shader, m_shader); }
 GLuint GLShaderStage::GetShaderId() const { return m_shader; };
 
 /////////////
@@ -98,36 +238,270 @@ std::shared_ptr<GLShaderProgram> GLShaderProgram::Create()
 
 GLShaderProgram::GLShaderProgram(GLuint program) : m_program {program} {}
 
-GLShaderProgram::~GLShaderProgram() { glDeleteProgram(m_program); }
+GLShaderProgram::~GLShaderProgram() { prosper::GLDeletionQueue::Get().Enqueue(prosper::GLObjectType::Program, m_program); }
 
-void GLShaderProgram::AttachShader(GLShaderStage &shaderStage) { glAttachShader(m_program, shaderStage.GetShaderId()); }
 GLuint GLShaderProgram::GetProgramId() const { return m_program; }
-bool GLShaderProgram::Link(std::string &outErr)
+void GLShaderProgram::SubmitLink(std::vector<std::shared_ptr<GLShaderStage>> stages, const std::optional<uint64_t> &programCacheKey)
 {
+	m_programCacheKey = programCacheKey;
+	if(programCacheKey)
+		glProgramParameteri(m_program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	for(auto &stage : stages) {
+		stage->EnsureSubmitted();
+		glAttachShader(m_program, stage->GetShaderId());
+	}
 	glLinkProgram(m_program);
+	m_pendingStages = std::move(stages);
+	m_status = Status::Pending;
+}
+bool GLShaderProgram::IsLinkComplete(bool parallelShaderCompile) const
+{
+	if(m_status != Status::Pending || !parallelShaderCompile)
+		return true;
+	GLint completed = GL_FALSE;
+	glGetProgramiv(m_program, GL_COMPLETION_STATUS_KHR, &completed);
+	return completed == GL_TRUE;
+}
+GLShaderProgram::Status GLShaderProgram::FinalizeLink(prosper::GLProgramCache *programCache, std::string &outErr)
+{
+	if(m_status != Status::Pending)
+		return m_status;
+	// Blocks until the link has completed
 	GLint linkStatus;
 	glGetProgramiv(m_program, GL_LINK_STATUS, &linkStatus);
 	if(linkStatus == GL_FALSE) {
+		m_status = Status::Failed;
+		// Compile errors are only reported here if the stages were compiled asynchronously
+		for(auto &stage : m_pendingStages) {
+			std::string compileErr;
+			if(stage->CheckCompileStatus(compileErr) == false)
+				outErr += compileErr;
+		}
 		GLsizei len = 0;
 		glGetProgramiv(m_program, GL_INFO_LOG_LENGTH, &len);
 		std::vector<GLchar> vInfoLog;
 		vInfoLog.resize(len);
 		len = 0;
-		glGetProgramInfoLog(m_program, len, nullptr, vInfoLog.data());
+		glGetProgramInfoLog(m_program, vInfoLog.size(), &len, vInfoLog.data());
 		if(len > 0)
-			outErr = vInfoLog.data();
-		else
-			outErr = "";
-		return false;
+			outErr += vInfoLog.data();
+	}
+	else {
+		m_status = Status::Linked;
+		if(programCache && m_programCacheKey) {
+			GLenum format;
+			std::vector<uint8_t> data;
+			if(GetBinary(format, data))
+				programCache->Store(*m_programCacheKey, format, std::move(data));
+		}
 	}
+	for(auto &stage : m_pendingStages)
+		glDetachShader(m_program, stage->GetShaderId());
+	m_pendingStages.clear();
+	return m_status;
+}
+bool GLShaderProgram::LoadBinary(GLenum format, const void *data, size_t size)
+{
+	glProgramBinary(m_program, format, data, size);
+	GLint linkStatus;
+	glGetProgramiv(m_program, GL_LINK_STATUS, &linkStatus);
+	if(linkStatus != GL_TRUE)
+		return false;
+	m_status = Status::Linked;
 	return true;
 }
+bool GLShaderProgram::GetBinary(GLenum &outFormat, std::vector<uint8_t> &outData) const
+{
+	GLint size = 0;
+	glGetProgramiv(m_program, GL_PROGRAM_BINARY_LENGTH, &size);
+	if(size <= 0)
+		return false;
+	outData.resize(size);
+	GLsizei len = 0;
+	glGetProgramBinary(m_program, size, &len, &outFormat, outData.data());
+	outData.resize(len);
+	return len > 0;
+}
+
+static void get_specialization_constants(const prosper::BasePipelineCreateInfo &createInfo, prosper::ShaderStage stage, std::vector<GLuint> &outConstantIds, std::vector<GLuint> &outConstantValues)
+{
+	uint32_t numConstants = 0;
+	const prosper::SpecializationConstant *constants = nullptr;
+	const uint8_t *data = nullptr;
+	if(createInfo.GetSpecializationConstants(stage, &numConstants, &constants, &data) == false)
+		return;
+	outConstantIds.reserve(numConstants);
+	outConstantValues.reserve(numConstants);
+	for(auto i = decltype(numConstants) {0u}; i < numConstants; ++i) {
+		auto &constant = constants[i];
+		// glSpecializeShader only supports 32-bit scalar constants
+		if(constant.numBytes != sizeof(GLuint))
+			continue;
+		GLuint value;
+		std::memcpy(&value, data + constant.startOffset, sizeof(value));
+		outConstantIds.push_back(constant.constantId);
+		outConstantValues.push_back(value);
+	}
+}
+
+static uint64_t calc_specialization_key(prosper::ShaderStage stage, const std::vector<GLuint> &constantIds, const std::vector<GLuint> &constantValues)
+{
+	auto stageIdx = pragma::math::to_integral(stage);
+	uint64_t numConstants = constantIds.size();
+	auto key = prosper::util::hash_fnv1a(&stageIdx, sizeof(stageIdx));
+	key = prosper::util::hash_fnv1a(&numConstants, sizeof(numConstants), key);
+	key = prosper::util::hash_fnv1a(constantIds.data(), constantIds.size() * sizeof(GLuint), key);
+	return prosper::util::hash_fnv1a(constantValues.data(), constantValues.size() * sizeof(GLuint), key);
+}
+
+template<typename T>
+static void add_shared_object(std::unordered_map<uint64_t, std::weak_ptr<T>> &objects, uint64_t key, const std::shared_ptr<T> &object)
+{
+	// Expired entries are removed whenever the number of entries reaches a power of two
+	if(objects.size() >= 64 && std::has_single_bit(objects.size()))
+		std::erase_if(objects, [](const auto &pair) { return pair.second.expired(); });
+	objects[key] = object;
+}
+
+static uint64_t calc_stage_content_key(prosper::ShaderStage stage, const void *data, size_t size)
+{
+	auto stageIdx = pragma::math::to_integral(stage);
+	auto key = prosper::util::hash_fnv1a(&stageIdx, sizeof(stageIdx));
+	return prosper::util::hash_fnv1a(data, size, key);
+}
+
+// Key of a program, derived from the content keys of its stages (ordered by stage) and their specialization
+struct ProgramStageKey {
+	prosper::ShaderStage stage;
+	uint64_t contentKey;
+	std::optional<uint64_t> variantKey;
+};
+static uint64_t calc_program_content_key(std::vector<ProgramStageKey> &stageKeys)
+{
+	std::sort(stageKeys.begin(), stageKeys.end(), [](const ProgramStageKey &a, const ProgramStageKey &b) { return a.stage < b.stage; });
+	uint64_t key = 0;
+	for(auto &stageKey : stageKeys) {
+		key = prosper::util::hash_fnv1a(&stageKey.contentKey, sizeof(stageKey.contentKey), key);
+		if(stageKey.variantKey)
+			key = prosper::util::hash_fnv1a(&*stageKey.variantKey, sizeof(*stageKey.variantKey), key);
+	}
+	return key;
+}
+// Stable key of the unspecialized stages of a pipeline
+static uint64_t calc_pipeline_stage_key(const std::vector<std::shared_ptr<GLShaderStage>> &stages)
+{
+	std::vector<ProgramStageKey> stageKeys;
+	stageKeys.reserve(stages.size());
+	for(auto &stage : stages)
+		stageKeys.push_back({stage->GetStage(), stage->GetContentKey().value_or(0), {}});
+	return calc_program_content_key(stageKeys);
+}
+
+static bool is_synchronous(const std::vector<std::shared_ptr<GLShaderStage>> &stages)
+{
+	return std::any_of(stages.begin(), stages.end(), [](const std::shared_ptr<GLShaderStage> &stage) { return stage && stage->IsSynchronous(); });
+}
+
+// Returns the program for the stages if another pipeline with identical stages and specialization already has one.
+// Otherwise the program is created from the cached binary if available, or linking is started from the stages.
+// Stages are specialized with the specialization constants of the pipeline first, GLSL stages by compiling
+// a variant with the constant values substituted and SPIR-V stages with glSpecializeShader.
+// The link result has to be retrieved with GLShaderProgram::FinalizeLink.
+static std::shared_ptr<GLShaderProgram> create_program(prosper::GLProgramCache *programCache, std::unordered_map<uint64_t, std::weak_ptr<GLShaderProgram>> &sharedPrograms, std::vector<std::shared_ptr<GLShaderStage>> stages,
+  const prosper::BasePipelineCreateInfo &createInfo, std::string &outErr)
+{
+	struct StageSpecialization {
+		std::vector<GLuint> constantIds;
+		std::vector<GLuint> constantValues;
+		std::optional<uint64_t> variantKey;
+	};
+	std::vector<StageSpecialization> specializations(stages.size());
+	std::vector<ProgramStageKey> stageKeys;
+	stageKeys.reserve(stages.size());
+	for(auto i = decltype(stages.size()) {0u}; i < stages.size(); ++i) {
+		auto &stage = stages.at(i);
+		auto &specialization = specializations.at(i);
+		if(stage->IsSpirv() || stage->HasSpecializationConstants()) {
+			get_specialization_constants(createInfo, stage->GetStage(), specialization.constantIds, specialization.constantValues);
+			// GLSL stages without specialization info use the stage itself, which was compiled with the default values
+			if(stage->IsSpirv() || specialization.constantIds.empty() == false)
+				specialization.variantKey = calc_specialization_key(stage->GetStage(), specialization.constantIds, specialization.constantValues);
+		}
+		if(stage->GetContentKey())
+			stageKeys.push_back({stage->GetStage(), *stage->GetContentKey(), specialization.variantKey});
+	}
+	std::optional<uint64_t> programKey {};
+	if(stages.empty() == false && stageKeys.size() == stages.size()) {
+		programKey = calc_program_content_key(stageKeys);
+		auto it = sharedPrograms.find(*programKey);
+		if(it != sharedPrograms.end()) {
+			if(auto program = it->second.lock())
+				return program;
+		}
+	}
+
+	for(auto i = decltype(stages.size()) {0u}; i < stages.size(); ++i) {
+		auto &stage = stages.at(i);
+		auto &specialization = specializations.at(i);
+		if(specialization.variantKey.has_value() == false)
+			continue;
+		if(stage->IsSpirv()) {
+			stage = stage->Specialize(specialization.constantIds, specialization.constantValues, outErr);
+			if(stage == nullptr)
+				return nullptr;
+			continue;
+		}
+		stage = stage->GetVariant(specialization.constantIds, specialization.constantValues, *specialization.variantKey);
+	}
+
+	std::shared_ptr<GLShaderProgram> program = nullptr;
+	std::optional<uint64_t> programCacheKey {};
+	if(programCache && programKey) {
+		programCacheKey = prosper::GLProgramCache::CalcProgramKey(*programKey, programCache->GetDriverHash());
+		auto binary = programCache->Find(*programCacheKey);
+		if(binary) {
+			program = GLShaderProgram::Create();
+			if(program->LoadBinary(binary->format, binary->data, binary->size) == false) {
+				// The driver rejected the binary, fall back to compiling the shader sources
+				programCache->Remove(*programCacheKey);
+				program = nullptr;
+			}
+		}
+	}
+	if(program == nullptr) {
+		program = GLShaderProgram::Create();
+		program->SubmitLink(std::move(stages), programCacheKey);
+	}
+	if(programKey)
+		add_shared_object(sharedPrograms, *programKey, program);
+	return program;
+}
 
 /////////////
 
 std::shared_ptr<prosper::GLContext> prosper::GLContext::Create(const std::string &appName, bool bEnableValidation) { return std::shared_ptr<prosper::GLContext> {new GLContext {appName, bEnableValidation}}; }
 prosper::GLContext::GLContext(const std::string &appName, bool bEnableValidation) : IPrContext {appName, bEnableValidation} {}
-prosper::GLContext::~GLContext() { m_pipelines.clear(); }
+prosper::GLContext::~GLContext()
+{
+	SetThreadedSubmissionEnabled(false);
+	RetireTimelineSyncs(true);
+	// All submitted work has been completed, coroutines that are still suspended afterwards can never be resumed
+	m_gpuScheduler.Resume();
+	m_gpuScheduler.Clear();
+	m_pipelines.clear();
+	for(auto &slot : m_frameSlots) {
+		if(slot.fence)
+			glDeleteSync(slot.fence);
+	}
+	if(m_warmUpFramebuffer != 0) {
+		glDeleteFramebuffers(1, &m_warmUpFramebuffer);
+		glDeleteRenderbuffers(m_warmUpRenderbuffers.size(), m_warmUpRenderbuffers.data());
+		glDeleteVertexArrays(1, &m_warmUpVertexArray);
+	}
+	m_stagingBuffer = nullptr;
+	GLDeletionQueue::Get().CollectAll();
+	GLDeletionQueue::Get().Deactivate();
+}
 bool prosper::GLContext::IsImageFormatSupported(prosper::Format format, prosper::ImageUsageFlags usageFlags, prosper::ImageType type, prosper::ImageTiling tiling) const
 {
 	return true; // TODO
@@ -144,7 +518,234 @@ prosper::FeatureSupport prosper::GLContext::AreFormatFeaturesSupported(Format fo
 }
 void prosper::GLContext::BakeShaderPipeline(prosper::PipelineID pipelineId, prosper::PipelineBindPoint pipelineType)
 {
-	// Nothing to be done
+	if(RequiresGLThreadRoundTrip())
+		return RunOnGLThread([&]() { BakeShaderPipeline(pipelineId, pipelineType); });
+	if(pipelineType != prosper::PipelineBindPoint::Graphics || BakePipelineState(pipelineId) == false)
+		return;
+	if(m_pipelineWarmUpEnabled == false)
+		return;
+	// The GL state of the command buffer that is being recorded must not be changed
+	if(pragma::math::is_flag_set(m_stateFlags, StateFlags::IsRecording))
+		m_pipelineWarmUpQueue.push_back(pipelineId);
+	else
+		WarmUpPipeline(pipelineId);
+}
+bool prosper::GLContext::BakePipelineState(PipelineID pipelineId)
+{
+	if(pipelineId >= m_pipelines.size())
+		return false;
+	auto &pipelineData = m_pipelines.at(pipelineId);
+	if(pipelineData.state)
+		return true;
+	if(pipelineData.shader.expired() || pipelineData.shader->IsGraphicsShader() == false)
+		return false;
+	auto *createInfo = static_cast<prosper::GraphicsPipelineCreateInfo *>(pipelineData.shader->GetPipelineCreateInfo(pipelineData.shaderPipelineId));
+	if(createInfo == nullptr)
+		return false;
+	PipelineState state {};
+	bool blendingEnabled;
+	prosper::BlendOp blendOpColor, blendOpAlpha;
+	prosper::BlendFactor srcColorBlendFactor, dstColorBlendFactor, srcAlphaBlendFactor, dstAlphaBlendFactor;
+	prosper::ColorComponentFlags channelWriteMask;
+	auto res = createInfo->GetColorBlendAttachmentProperties(0 /* sub-pass id */, &blendingEnabled, &blendOpColor, &blendOpAlpha, &srcColorBlendFactor, &dstColorBlendFactor, &srcAlphaBlendFactor, &dstAlphaBlendFactor, &channelWriteMask);
+	if(res && blendingEnabled) {
+		state.blendEnabled = true;
+		state.blendOpColor = util::to_opengl_enum(blendOpColor);
+		state.blendOpAlpha = util::to_opengl_enum(blendOpAlpha);
+		state.srcColorBlendFactor = util::to_opengl_enum(srcColorBlendFactor);
+		state.dstColorBlendFactor = util::to_opengl_enum(dstColorBlendFactor);
+		state.srcAlphaBlendFactor = util::to_opengl_enum(srcAlphaBlendFactor);
+		state.dstAlphaBlendFactor = util::to_opengl_enum(dstAlphaBlendFactor);
+		state.colorMask = {pragma::math::is_flag_set(channelWriteMask, prosper::ColorComponentFlags::RBit), pragma::math::is_flag_set(channelWriteMask, prosper::ColorComponentFlags::GBit), pragma::math::is_flag_set(channelWriteMask, prosper::ColorComponentFlags::BBit),
+		  pragma::math::is_flag_set(channelWriteMask, prosper::ColorComponentFlags::ABit)};
+	}
+
+	prosper::PolygonMode polygonMode;
+	prosper::CullModeFlags cullModeFlags;
+	prosper::FrontFace frontFace;
+	createInfo->GetRasterizationProperties(&polygonMode, &cullModeFlags, &frontFace, &state.lineWidth);
+	switch(cullModeFlags) {
+	case prosper::CullModeFlags::FrontAndBack:
+		state.cullFaceEnabled = true;
+		state.cullFace = GL_FRONT_AND_BACK;
+		break;
+	case prosper::CullModeFlags::BackBit:
+		state.cullFaceEnabled = true;
+		state.cullFace = GL_FRONT;
+		break;
+	case prosper::CullModeFlags::FrontBit:
+		state.cullFaceEnabled = true;
+		state.cullFace = GL_BACK;
+		break;
+	default:
+		break;
+	}
+	// glClipControl with an upper-left origin inverts the winding order
+	auto cw = (frontFace == prosper::FrontFace::Clockwise);
+	if(m_clipControlEnabled)
+		cw = !cw;
+	state.frontFace = cw ? GL_CW : GL_CCW;
+
+	if(createInfo->GetDynamicScissorBoxesCount() > 0)
+		state.scissorTestEnabled = true;
+	else {
+		int32_t scissorX, scissorY;
+		uint32_t scissorW, scissorH;
+		if(createInfo->GetScissorBoxesCount() > 0 && createInfo->GetScissorBoxProperties(0, &scissorX, &scissorY, &scissorW, &scissorH)) {
+			state.scissorTestEnabled = true;
+			state.scissor = {scissorX, scissorY, static_cast<GLint>(scissorW), static_cast<GLint>(scissorH)};
+		}
+	}
+
+	createInfo->GetDepthBiasState(&state.depthBiasEnabled, nullptr, nullptr, nullptr);
+
+	if(createInfo->GetDynamicViewportsCount() == 0) {
+		float viewportX, viewportY, viewportW, viewportH;
+		float minDepth, maxDepth;
+		if(createInfo->GetViewportCount() > 0 && createInfo->GetViewportProperties(0, &viewportX, &viewportY, &viewportW, &viewportH, &minDepth, &maxDepth)) {
+			state.viewport = {static_cast<GLint>(viewportX), static_cast<GLint>(viewportY), static_cast<GLint>(viewportW), static_cast<GLint>(viewportH)};
+			state.depthRange = {minDepth, maxDepth};
+		}
+		else {
+			std::array<GLint, 2> viewportDims;
+			glGetIntegerv(GL_MAX_VIEWPORT_DIMS, viewportDims.data());
+			state.viewport = {0, 0, viewportDims[0], viewportDims[1]};
+		}
+	}
+
+	bool isDepthTestEnabled;
+	prosper::CompareOp depthCompareOp;
+	createInfo->GetDepthTestState(&isDepthTestEnabled, &depthCompareOp);
+	if(isDepthTestEnabled) {
+		state.depthTestEnabled = true;
+		state.depthFunc = util::to_opengl_enum(depthCompareOp);
+	}
+	state.depthMask = createInfo->AreDepthWritesEnabled() ? GL_TRUE : GL_FALSE;
+	pipelineData.state = state;
+	return true;
+}
+const prosper::GLContext::PipelineState *prosper::GLContext::GetPipelineState(PipelineID pipelineId)
+{
+	if(RequiresGLThreadRoundTrip())
+		return RunOnGLThread([&]() { return GetPipelineState(pipelineId); });
+	if(BakePipelineState(pipelineId) == false)
+		return nullptr;
+	return &*m_pipelines.at(pipelineId).state;
+}
+void prosper::GLContext::ApplyPipelineState(const PipelineState &state) const
+{
+	if(state.blendEnabled) {
+		glEnable(GL_BLEND);
+		glBlendEquationSeparate(state.blendOpColor, state.blendOpAlpha);
+		glBlendFuncSeparate(state.srcColorBlendFactor, state.dstColorBlendFactor, state.srcAlphaBlendFactor, state.dstAlphaBlendFactor);
+		glColorMask(state.colorMask[0], state.colorMask[1], state.colorMask[2], state.colorMask[3]);
+	}
+	else
+		glDisable(GL_BLEND);
+
+	if(state.cullFaceEnabled) {
+		glEnable(GL_CULL_FACE);
+		glCullFace(state.cullFace);
+	}
+	else
+		glDisable(GL_CULL_FACE);
+	glFrontFace(state.frontFace);
+	glLineWidth(state.lineWidth);
+
+	if(state.scissorTestEnabled)
+		glEnable(GL_SCISSOR_TEST);
+	else
+		glDisable(GL_SCISSOR_TEST);
+
+	if(state.depthBiasEnabled)
+		glEnable(GL_POLYGON_OFFSET_FILL);
+	else
+		glDisable(GL_POLYGON_OFFSET_FILL);
+	if(state.viewport)
+		glDepthRangef(state.depthRange[0], state.depthRange[1]);
+
+	if(state.depthTestEnabled) {
+		glEnable(GL_DEPTH_TEST);
+		glDepthFunc(state.depthFunc);
+	}
+	else
+		glDisable(GL_DEPTH_TEST);
+	glDepthMask(state.depthMask);
+}
+void prosper::GLContext::WarmUpPipeline(PipelineID pipelineId)
+{
+	// Don't stall on pipelines that are still being linked
+	auto &pipelineData = m_pipelines.at(pipelineId);
+	if(pipelineData.state.has_value() == false || pipelineData.program == nullptr || pipelineData.shader.expired() || IsPipelineReady(pipelineId) == false)
+		return;
+	if(m_warmUpFramebuffer == 0) {
+		glCreateRenderbuffers(m_warmUpRenderbuffers.size(), m_warmUpRenderbuffers.data());
+		glNamedRenderbufferStorage(m_warmUpRenderbuffers[0], GL_RGBA8, 1, 1);
+		glNamedRenderbufferStorage(m_warmUpRenderbuffers[1], GL_DEPTH24_STENCIL8, 1, 1);
+		glCreateFramebuffers(1, &m_warmUpFramebuffer);
+		glNamedFramebufferRenderbuffer(m_warmUpFramebuffer, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, m_warmUpRenderbuffers[0]);
+		glNamedFramebufferRenderbuffer(m_warmUpFramebuffer, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, m_warmUpRenderbuffers[1]);
+		glCreateVertexArrays(1, &m_warmUpVertexArray);
+	}
+	GLint prevFramebuffer, prevVertexArray;
+	std::array<GLint, 4> prevViewport, prevScissor;
+	glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &prevFramebuffer);
+	glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &prevVertexArray);
+	glGetIntegerv(GL_VIEWPORT, prevViewport.data());
+	glGetIntegerv(GL_SCISSOR_BOX, prevScissor.data());
+	auto prevScissorTest = glIsEnabled(GL_SCISSOR_TEST);
+	std::array<GLboolean, 4> prevColorMask;
+	GLboolean prevDepthMask;
+	glGetBooleanv(GL_COLOR_WRITEMASK, prevColorMask.data());
+	glGetBooleanv(GL_DEPTH_WRITEMASK, &prevDepthMask);
+	auto prevProgram = m_activeProgram;
+
+	// The driver compiles a variant for the primitive type, so the draw has to use the same one as the actual draws (see GLCommandBuffer::RecordDraw).
+	// Pipelines with tessellation stages can only be drawn with patches.
+	GLenum drawMode = GL_TRIANGLES;
+	auto &stages = pipelineData.shader->GetStages();
+	auto tescIdx = pragma::math::to_integral(prosper::ShaderStage::TessellationControl);
+	auto teseIdx = pragma::math::to_integral(prosper::ShaderStage::TessellationEvaluation);
+	auto hasStage = [&stages](size_t idx) { return idx < stages.size() && stages.at(idx) && stages.at(idx)->path.empty() == false; };
+	if(hasStage(tescIdx) || hasStage(teseIdx))
+		drawMode = GL_PATCHES;
+	else if(auto *createInfo = static_cast<prosper::GraphicsPipelineCreateInfo *>(pipelineData.shader->GetPipelineCreateInfo(pipelineData.shaderPipelineId)))
+		drawMode = util::to_opengl_enum(createInfo->GetPrimitiveTopology());
+
+	// An empty scissor rectangle discards all fragments, but the draw still has to be prepared by the driver
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_warmUpFramebuffer);
+	glBindVertexArray(m_warmUpVertexArray);
+	UseProgram(pipelineData.program->GetProgramId());
+	ApplyPipelineState(*pipelineData.state);
+	glEnable(GL_SCISSOR_TEST);
+	glViewport(0, 0, 1, 1);
+	glScissor(0, 0, 0, 0);
+	// Six vertices form at least one complete primitive for every mode (including adjacency and patches of up to six vertices)
+	glDrawArrays(drawMode, 0, 6);
+
+	// The blend, depth and cull state is applied again by the next pipeline bind, the write masks are restored since
+	// the color mask is only applied by pipelines with blending enabled
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, prevFramebuffer);
+	glBindVertexArray(prevVertexArray);
+	glViewport(prevViewport[0], prevViewport[1], prevViewport[2], prevViewport[3]);
+	glScissor(prevScissor[0], prevScissor[1], prevScissor[2], prevScissor[3]);
+	if(prevScissorTest)
+		glEnable(GL_SCISSOR_TEST);
+	else
+		glDisable(GL_SCISSOR_TEST);
+	glColorMask(prevColorMask[0], prevColorMask[1], prevColorMask[2], prevColorMask[3]);
+	glDepthMask(prevDepthMask);
+	UseProgram(prevProgram);
+	CheckResult();
+}
+void prosper::GLContext::ProcessPipelineWarmUpQueue()
+{
+	auto queue = std::move(m_pipelineWarmUpQueue);
+	m_pipelineWarmUpQueue.clear();
+	for(auto pipelineId : queue) {
+		if(pipelineId < m_pipelines.size())
+			WarmUpPipeline(pipelineId);
+	}
 }
 uint32_t prosper::GLContext::GetUniversalQueueFamilyIndex() const { return 0; }
 prosper::util::Limits prosper::GLContext::GetPhysicalDeviceLimits() const
@@ -243,7 +844,131 @@ std::expected<std::shared_ptr<prosper::Window>, std::string> prosper::GLContext:
 
 prosper::GLBuffer &prosper::GLContext::GetPushConstantBuffer() const { return m_pushConstantBuffer->GetAPITypeRef<GLBuffer>(); }
 
-std::optional<GLuint> prosper::GLContext::GetPipelineProgram(PipelineID pipelineId) const { return (pipelineId < m_pipelines.size() && m_pipelines.at(pipelineId).program) ? m_pipelines.at(pipelineId).program->GetProgramId() : std::optional<GLuint> {}; }
+bool prosper::GLContext::IsPipelineReady(PipelineID pipelineId, std::string *outInfoLog)
+{
+	// The pipeline table is modified by the GL thread (see ProcessPipelineLinkQueue)
+	if(RequiresGLThreadRoundTrip())
+		return RunOnGLThread([&]() { return IsPipelineReady(pipelineId, outInfoLog); });
+	if(pipelineId >= m_pipelines.size())
+		return false;
+	auto &pipelineData = m_pipelines.at(pipelineId);
+	auto &program = pipelineData.program;
+	if(program && program->GetStatus() == GLShaderProgram::Status::Pending) {
+		if(program->IsLinkComplete(m_parallelShaderCompile) == false)
+			return false;
+		std::string err;
+		if(program->FinalizeLink(m_programCache.get(), err) == GLShaderProgram::Status::Failed) {
+			pipelineData.linkError = "Failed to link shader pipeline " + pragma::util::to_string(pipelineId) + ": " + err;
+			if(outInfoLog == nullptr)
+				ValidationCallback(prosper::DebugMessageSeverityFlags::ErrorBit, pipelineData.linkError);
+		}
+	}
+	if(program && program->GetStatus() == GLShaderProgram::Status::Linked)
+		return true;
+	// The error is handed to the first caller that asks for it, which is usually the first bind of the pipeline
+	if(outInfoLog && pipelineData.linkError.empty() == false) {
+		*outInfoLog = std::move(pipelineData.linkError);
+		pipelineData.linkError.clear();
+	}
+	return false;
+}
+bool prosper::GLContext::PreparePipelineForBind(PipelineID pipelineId, std::string *outInfoLog)
+{
+	if(RequiresGLThreadRoundTrip())
+		return RunOnGLThread([&]() { return PreparePipelineForBind(pipelineId, outInfoLog); });
+	if(pipelineId >= m_pipelines.size())
+		return false;
+	auto &pipelineData = m_pipelines.at(pipelineId);
+	if(pipelineData.bindCount++ == 0 && m_pipelineUsageProfile && pipelineData.shader.expired() == false)
+		m_pipelineUsageProfile->RecordFirstBind(pipelineData.shader->GetIdentifier(), pipelineData.shaderPipelineId, pipelineData.stageKey);
+	if(pipelineData.program == nullptr && LinkPipeline(pipelineId) == false) {
+		if(outInfoLog && pipelineData.linkError.empty() == false) {
+			*outInfoLog = std::move(pipelineData.linkError);
+			pipelineData.linkError.clear();
+		}
+		return false;
+	}
+	return IsPipelineReady(pipelineId, outInfoLog);
+}
+bool prosper::GLContext::LinkPipeline(PipelineID pipelineId)
+{
+	auto &pipelineData = m_pipelines.at(pipelineId);
+	if(pipelineData.program)
+		return true;
+	if(pipelineData.pendingStages.empty())
+		return false;
+	m_pipelineLinkQueue.erase({-pipelineData.linkPriority, pipelineId});
+	auto stages = std::move(pipelineData.pendingStages);
+	auto *createInfo = pipelineData.shader.expired() ? nullptr : pipelineData.shader->GetPipelineCreateInfo(pipelineData.shaderPipelineId);
+	if(createInfo == nullptr)
+		return false;
+	std::string err;
+	pipelineData.program = create_program(m_programCache.get(), m_sharedPrograms, std::move(stages), *createInfo, err);
+	if(pipelineData.program == nullptr) {
+		pipelineData.linkError = "Failed to link shader pipeline " + pragma::util::to_string(pipelineId) + ": " + err;
+		return false;
+	}
+	return CheckResult();
+}
+bool prosper::GLContext::IsPipelineLinkingDeferred() const
+{
+	// Without lazy linking, pipelines are only deferred to link them in the order of the previous session
+	return m_lazyPipelineLinkingEnabled || (m_pipelineUsageProfile && m_pipelineUsageProfile->HasPreviousSession());
+}
+void prosper::GLContext::ProcessPipelineLinkQueue()
+{
+	if(m_pipelineLinkQueue.empty())
+		return;
+	// The time budget only applies to lazy linking, otherwise the entire queue is linked
+	auto tStart = std::chrono::steady_clock::now();
+	do
+		LinkPipeline(m_pipelineLinkQueue.begin()->second);
+	while(m_pipelineLinkQueue.empty() == false && (m_lazyPipelineLinkingEnabled == false || std::chrono::steady_clock::now() - tStart < m_idleLinkTimeBudget));
+}
+void prosper::GLContext::SetPipelineLinkPriority(PipelineID pipelineId, int32_t priority)
+{
+	if(RequiresGLThreadRoundTrip())
+		return RunOnGLThread([&]() { SetPipelineLinkPriority(pipelineId, priority); });
+	if(pipelineId >= m_pipelines.size())
+		return;
+	auto &pipelineData = m_pipelines.at(pipelineId);
+	if(pipelineData.pendingStages.empty() == false && m_pipelineLinkQueue.erase({-pipelineData.linkPriority, pipelineId}) > 0)
+		m_pipelineLinkQueue.insert({-priority, pipelineId});
+	pipelineData.linkPriority = priority;
+}
+prosper::GLContext::PipelineUsageStats prosper::GLContext::GetPipelineUsageStats() const
+{
+	if(RequiresGLThreadRoundTrip())
+		return RunOnGLThread([this]() { return GetPipelineUsageStats(); });
+	PipelineUsageStats stats {};
+	for(auto &pipelineData : m_pipelines) {
+		if(pipelineData.shader.expired())
+			continue; // Pipeline has been cleared
+		++stats.numPipelines;
+		if(pipelineData.program && pipelineData.program->GetStatus() == GLShaderProgram::Status::Linked)
+			++stats.numLinked;
+		if(pipelineData.pendingStages.empty() == false)
+			++stats.numPendingLink;
+		if(pipelineData.bindCount > 0)
+			++stats.numUsed;
+		else
+			++stats.numNeverUsed;
+	}
+	return stats;
+}
+void prosper::GLContext::UseProgram(GLuint program)
+{
+	if(program == m_activeProgram)
+		return;
+	glUseProgram(program);
+	m_activeProgram = program;
+}
+std::optional<GLuint> prosper::GLContext::GetPipelineProgram(PipelineID pipelineId) const
+{
+	if(RequiresGLThreadRoundTrip())
+		return RunOnGLThread([&]() { return GetPipelineProgram(pipelineId); });
+	return (pipelineId < m_pipelines.size() && m_pipelines.at(pipelineId).program) ? m_pipelines.at(pipelineId).program->GetProgramId() : std::optional<GLuint> {};
+}
 
 bool prosper::GLContext::CheckResult()
 {
@@ -312,64 +1037,367 @@ std::shared_ptr<prosper::ShaderStageProgram> prosper::GLContext::CompileShader(p
 		return nullptr;
 	return GLShaderStage::Compile(stage, *shaderCode, outInfoLog);
 }
-bool prosper::GLContext::GetParsedShaderSourceCode(prosper::Shader &shader, std::vector<std::string> &outGlslCodePerStage, std::vector<prosper::ShaderStage> &outGlslCodeStages, std::string &outInfoLog, std::string &outDebugInfoLog, prosper::ShaderStage &outErrStage,
-  const std::string &prefixCode, const std::unordered_map<std::string, std::string> &definitions) const
+using SortedDefinitions = std::vector<const std::pair<const std::string, std::string> *>;
+static SortedDefinitions get_sorted_definitions(const std::unordered_map<std::string, std::string> &definitions)
+{
+	SortedDefinitions sortedDefinitions;
+	sortedDefinitions.reserve(definitions.size());
+	for(auto &pair : definitions)
+		sortedDefinitions.push_back(&pair);
+	std::sort(sortedDefinitions.begin(), sortedDefinitions.end(), [](const auto *a, const auto *b) { return a->first < b->first; });
+	return sortedDefinitions;
+}
+static uint64_t hash_string(const std::string &str, uint64_t hash)
+{
+	uint64_t len = str.size();
+	hash = prosper::util::hash_fnv1a(&len, sizeof(len), hash);
+	return prosper::util::hash_fnv1a(str.data(), str.size(), hash);
+}
+// Stable key for the inputs of a preprocessed shader stage. This also identifies dumped GLSL and precompiled SPIR-V files.
+static uint64_t calc_shader_stage_key(uint32_t stageIdx, const std::string &path, const std::string &prefixCode, const SortedDefinitions &sortedDefinitions, uint64_t seed)
+{
+	auto key = prosper::util::hash_fnv1a(&seed, sizeof(seed));
+	key = prosper::util::hash_fnv1a(&stageIdx, sizeof(stageIdx), key);
+	key = hash_string(path, key);
+	key = hash_string(prefixCode, key);
+	for(auto *pair : sortedDefinitions) {
+		key = hash_string(pair->first, key);
+		key = hash_string(pair->second, key);
+	}
+	return key;
+}
+static uint64_t calc_parsed_shader_source_key(prosper::Shader &shader, const std::string &prefixCode, const std::unordered_map<std::string, std::string> &definitions, uint64_t seed)
+{
+	auto sortedDefinitions = get_sorted_definitions(definitions);
+	uint64_t key = 0;
+	auto &stages = shader.GetStages();
+	for(auto i = decltype(stages.size()) {0}; i < stages.size(); ++i) {
+		auto &stage = stages.at(i);
+		if(stage == nullptr || stage->path.empty())
+			continue;
+		auto stageKey = calc_shader_stage_key(i, stage->path, prefixCode, sortedDefinitions, seed);
+		key = prosper::util::hash_fnv1a(&stageKey, sizeof(stageKey), key);
+	}
+	return key;
+}
+static std::string get_shader_stage_file_name(uint64_t stageKey) { return std::format("{:016x}", stageKey); }
+static std::string_view get_shader_stage_file_extension(prosper::ShaderStage stage)
+{
+	// Extensions recognized by glslangValidator
+	switch(stage) {
+	case prosper::ShaderStage::Compute:
+		return "comp";
+	case prosper::ShaderStage::Fragment:
+		return "frag";
+	case prosper::ShaderStage::Geometry:
+		return "geom";
+	case prosper::ShaderStage::TessellationControl:
+		return "tesc";
+	case prosper::ShaderStage::TessellationEvaluation:
+		return "tese";
+	case prosper::ShaderStage::Vertex:
+		return "vert";
+	}
+	return "glsl";
+}
+static std::optional<std::filesystem::file_time_type> get_file_time(const std::string &path)
+{
+	std::error_code ec;
+	auto t = std::filesystem::last_write_time(path, ec);
+	if(ec)
+		return {};
+	return t;
+}
+// Assigns the stage type to all stages of the shader, must not be called from the preprocessing threads
+static void assign_shader_stages(prosper::Shader &shader)
+{
+	auto &stages = shader.GetStages();
+	for(auto i = decltype(stages.size()) {0}; i < stages.size(); ++i) {
+		if(stages.at(i) && stages.at(i)->path.empty() == false)
+			stages.at(i)->stage = static_cast<prosper::ShaderStage>(i);
+	}
+}
+bool prosper::GLContext::GetPreprocessedShaderSources(prosper::Shader &shader, ParsedShaderSource &outSource, std::string &outInfoLog, std::string &outDebugInfoLog, prosper::ShaderStage &outErrStage, const std::string &prefixCode,
+  const std::unordered_map<std::string, std::string> &definitions, bool reload) const
 {
 	outErrStage = prosper::ShaderStage::Unknown;
 	auto &stages = shader.GetStages();
-	auto &glslCodePerStage = outGlslCodePerStage;
-	auto &glslCodeStages = outGlslCodeStages;
+	auto cacheKey = calc_parsed_shader_source_key(shader, prefixCode, definitions, GetShaderKeySeed());
+	{
+		std::scoped_lock lock {m_parsedShaderSourceCacheMutex};
+		auto it = m_parsedShaderSourceCache.find(cacheKey);
+		if(it != m_parsedShaderSourceCache.end()) {
+			auto &entry = it->second;
+			auto upToDate = !reload && std::all_of(entry.fileTimes.begin(), entry.fileTimes.end(), [](const auto &pair) { return get_file_time(pair.first) == pair.second; });
+			if(upToDate) {
+				outSource = entry;
+				return true;
+			}
+			m_parsedShaderSourceCache.erase(it);
+		}
+	}
+
+	ParsedShaderSource entry {};
+	auto &glslCodePerStage = entry.glslCodePerStage;
+	auto &glslCodeStages = entry.glslCodeStages;
 	glslCodePerStage.reserve(stages.size());
 	glslCodeStages.reserve(stages.size());
 	for(auto i = decltype(stages.size()) {0}; i < stages.size(); ++i) {
 		auto &stage = stages.at(i);
 		if(stage == nullptr || stage->path.empty())
 			continue;
-		stage->stage = static_cast<prosper::ShaderStage>(i);
+		// The shader may be preprocessed by multiple threads at once (with different definitions), so the stage
+		// is only assigned to the shader by the caller (see assign_shader_stages)
+		auto shaderStage = static_cast<prosper::ShaderStage>(i);
+		entry.fileTimes.push_back({stage->path, get_file_time(stage->path)});
 		std::vector<prosper::glsl::IncludeLine> includeLines;
 		unsigned int lineOffset = 0;
 		auto applyPreprocessing = true;
-		auto glslCode = prosper::glsl::load_glsl(const_cast<GLContext &>(*this), stage->stage, stage->path, &outInfoLog, &outDebugInfoLog, includeLines, lineOffset, prefixCode, definitions, applyPreprocessing);
+		// load_glsl only reads from the context, see PreprocessShaderSources
+		auto glslCode = prosper::glsl::load_glsl(const_cast<GLContext &>(*this), shaderStage, stage->path, &outInfoLog, &outDebugInfoLog, includeLines, lineOffset, prefixCode, definitions, applyPreprocessing);
 		if(glslCode.has_value() == false) {
-			outErrStage = stage->stage;
+			outErrStage = shaderStage;
 			return false;
 		}
 		glslCodePerStage.emplace_back(std::move(*glslCode));
-		glslCodeStages.push_back(stage->stage);
-	}
-	for(auto &code : glslCodePerStage) {
-		auto posConstantId = code.find("layout(constant_id");
-		while(posConstantId != std::string::npos) {
-			auto posConstantIdEnd = code.find(")", posConstantId);
-			if(posConstantIdEnd != std::string::npos) {
-				code = code.substr(0, posConstantId) + code.substr(posConstantIdEnd + 1);
-			}
-			posConstantId = code.find("layout(constant_id", posConstantId + 1);
+		glslCodeStages.push_back(shaderStage);
+	}
+	if(util::rewrite_glsl_for_opengl(glslCodePerStage, outInfoLog, true) == false)
+		return false;
+	if(m_shaderSourceDumpPath.empty() == false)
+		DumpShaderSourceCode(shader, glslCodePerStage, glslCodeStages, prefixCode, definitions);
+
+	// The stages are compiled with the default values of their specialization constants, pipelines with
+	// specialization info use their own variants (see create_program).
+	entry.defaultGlslCodePerStage.resize(glslCodePerStage.size());
+	entry.contentKeys.reserve(glslCodePerStage.size());
+	for(auto i = decltype(glslCodePerStage.size()) {0u}; i < glslCodePerStage.size(); ++i) {
+		auto &glslCode = glslCodePerStage.at(i);
+		if(glslCode.find("layout(constant_id") != std::string::npos)
+			entry.defaultGlslCodePerStage.at(i) = util::specialize_glsl(glslCode, {}, {});
+		entry.contentKeys.push_back(calc_stage_content_key(glslCodeStages.at(i), glslCode.data(), glslCode.size()));
+	}
+
+	outSource = entry;
+	std::scoped_lock lock {m_parsedShaderSourceCacheMutex};
+	m_parsedShaderSourceCache[cacheKey] = std::move(entry);
+	return true;
+}
+bool prosper::GLContext::GetParsedShaderSourceCode(prosper::Shader &shader, std::vector<std::string> &outGlslCodePerStage, std::vector<prosper::ShaderStage> &outGlslCodeStages, std::string &outInfoLog, std::string &outDebugInfoLog, prosper::ShaderStage &outErrStage,
+  const std::string &prefixCode, const std::unordered_map<std::string, std::string> &definitions, bool reload) const
+{
+	assign_shader_stages(shader);
+	ParsedShaderSource source;
+	if(GetPreprocessedShaderSources(shader, source, outInfoLog, outDebugInfoLog, outErrStage, prefixCode, definitions, reload) == false)
+		return false;
+	outGlslCodePerStage = std::move(source.glslCodePerStage);
+	outGlslCodeStages = std::move(source.glslCodeStages);
+	return true;
+}
+std::chrono::nanoseconds prosper::GLContext::PreprocessShaderSources(const std::vector<ShaderPreprocessInfo> &shaders, uint32_t numThreads, bool reload) const
+{
+	auto tStart = std::chrono::steady_clock::now();
+	if(numThreads == 0)
+		numThreads = std::max(std::thread::hardware_concurrency(), 1u);
+	numThreads = std::min(numThreads, static_cast<uint32_t>(shaders.size()));
+	// Every thread takes the next shader from a shared index, so a thread that is stuck on an expensive shader
+	// doesn't hold up the remaining ones
+	std::atomic<size_t> nextShaderIdx = 0;
+	auto worker = [this, &shaders, &nextShaderIdx, reload]() {
+		ParsedShaderSource source;
+		std::string infoLog;
+		std::string debugInfoLog;
+		prosper::ShaderStage errStage;
+		for(auto i = nextShaderIdx++; i < shaders.size(); i = nextShaderIdx++) {
+			auto &info = shaders.at(i);
+			if(info.shader == nullptr)
+				continue;
+			// Errors are reported once the shader sources are initialized
+			GetPreprocessedShaderSources(*info.shader, source, infoLog, debugInfoLog, errStage, info.prefixCode, info.definitions, reload);
 		}
+	};
+	std::vector<std::thread> threads;
+	threads.reserve(numThreads);
+	for(auto i = 1u; i < numThreads; ++i)
+		threads.emplace_back(worker);
+	worker();
+	for(auto &thread : threads)
+		thread.join();
+	return std::chrono::steady_clock::now() - tStart;
+}
+std::vector<std::chrono::nanoseconds> prosper::GLContext::BenchmarkShaderPreprocessing(const std::vector<ShaderPreprocessInfo> &shaders, uint32_t maxThreads) const
+{
+	if(maxThreads == 0)
+		maxThreads = std::max(std::thread::hardware_concurrency(), 1u);
+	std::vector<std::chrono::nanoseconds> times;
+	times.reserve(maxThreads);
+	// The first run isn't measured, so all runs read the shader files from the file system cache
+	PreprocessShaderSources(shaders, maxThreads, true);
+	for(auto numThreads = 1u; numThreads <= maxThreads; ++numThreads) {
+		// Memoized results are discarded, otherwise only the first run would do any work
+		times.push_back(PreprocessShaderSources(shaders, numThreads, true));
 	}
-	return util::convert_glsl_set_bindings_to_opengl_binding_points(glslCodePerStage, outInfoLog);
+	return times;
 }
 bool prosper::GLContext::GetParsedShaderSourceCode(prosper::Shader &shader, std::vector<std::string> &outGlslCodePerStage, std::vector<prosper::ShaderStage> &outGlslCodeStages, std::string &outInfoLog, std::string &outDebugInfoLog, prosper::ShaderStage &outErrStage) const
 {
-	return GetParsedShaderSourceCode(shader, outGlslCodePerStage, outGlslCodeStages, outInfoLog, outDebugInfoLog, outErrStage, {}, {});
+	if(GetParsedShaderSourceCode(shader, outGlslCodePerStage, outGlslCodeStages, outInfoLog, outDebugInfoLog, outErrStage, {}, {}) == false)
+		return false;
+	for(auto &glslCode : outGlslCodePerStage)
+		glslCode = util::specialize_glsl(glslCode, {}, {});
+	return true;
+}
+uint64_t prosper::GLContext::GetShaderKeySeed() const
+{
+	// The GLSL definitions depend on the clip control mode
+	return m_clipControlEnabled ? 1 : 0;
 }
+void prosper::GLContext::DumpShaderSourceCode(prosper::Shader &shader, const std::vector<std::string> &glslCodePerStage, const std::vector<prosper::ShaderStage> &glslCodeStages, const std::string &prefixCode, const std::unordered_map<std::string, std::string> &definitions) const
+{
+	// Specialization constants are kept, since they're supported when loading SPIR-V
+	std::error_code ec;
+	std::filesystem::create_directories(m_shaderSourceDumpPath, ec);
+	auto sortedDefinitions = get_sorted_definitions(definitions);
+	auto &stages = shader.GetStages();
+	for(auto i = decltype(glslCodeStages.size()) {0u}; i < glslCodeStages.size(); ++i) {
+		auto stage = glslCodeStages.at(i);
+		auto stageIdx = pragma::math::to_integral(stage);
+		auto stageKey = calc_shader_stage_key(stageIdx, stages.at(stageIdx)->path, prefixCode, sortedDefinitions, GetShaderKeySeed());
+		auto path = std::filesystem::path {m_shaderSourceDumpPath} / (get_shader_stage_file_name(stageKey) + '.' + std::string {get_shader_stage_file_extension(stage)});
+		std::ofstream f {path, std::ios::binary | std::ios::trunc};
+		f.write(glslCodePerStage.at(i).data(), glslCodePerStage.at(i).size());
+
+		// The content key is stored alongside the code, so outdated SPIR-V can be detected when loading it
+		auto &glslCode = glslCodePerStage.at(i);
+		std::ofstream fHash {std::filesystem::path {m_shaderSourceDumpPath} / (get_shader_stage_file_name(stageKey) + ".hash"), std::ios::trunc};
+		fHash << std::format("{:016x}", calc_stage_content_key(stage, glslCode.data(), glslCode.size()));
+	}
+}
+bool prosper::GLContext::LoadSpirvShaderStages(prosper::Shader &shader, const ParsedShaderSource &source, const std::string &prefixCode, const std::unordered_map<std::string, std::string> &definitions) const
+{
+	auto sortedDefinitions = get_sorted_definitions(definitions);
+	auto &stages = shader.GetStages();
+	std::vector<std::pair<uint32_t, std::vector<uint8_t>>> spirvStages;
+	for(auto i = decltype(stages.size()) {0}; i < stages.size(); ++i) {
+		auto &stage = stages.at(i);
+		if(stage == nullptr || stage->path.empty())
+			continue;
+		auto stageKey = calc_shader_stage_key(i, stage->path, prefixCode, sortedDefinitions, GetShaderKeySeed());
+		auto path = std::filesystem::path {m_spirvShaderPath} / (get_shader_stage_file_name(stageKey) + ".spv");
+		std::ifstream f {path, std::ios::binary | std::ios::ate};
+		if(!f)
+			return false; // All stages have to be available as SPIR-V, otherwise the GLSL code is used
+
+		// The SPIR-V has to have been compiled from the current source code (see DumpShaderSourceCode)
+		auto itStage = std::find(source.glslCodeStages.begin(), source.glslCodeStages.end(), static_cast<prosper::ShaderStage>(i));
+		if(itStage == source.glslCodeStages.end())
+			return false;
+		auto expectedHash = std::format("{:016x}", source.contentKeys.at(itStage - source.glslCodeStages.begin()));
+		std::string hash;
+		std::ifstream fHash {std::filesystem::path {m_spirvShaderPath} / (get_shader_stage_file_name(stageKey) + ".hash")};
+		if(!fHash || !(fHash >> hash) || hash != expectedHash) {
+			const_cast<GLContext *>(this)->ValidationCallback(prosper::DebugMessageSeverityFlags::WarningBit, "Precompiled SPIR-V '" + path.string() + "' of shader '" + shader.GetIdentifier() + "' is outdated, falling back to GLSL code.");
+			return false;
+		}
+		std::vector<uint8_t> spirv(static_cast<size_t>(f.tellg()));
+		f.seekg(0);
+		f.read(reinterpret_cast<char *>(spirv.data()), spirv.size());
+		if(!f)
+			return false;
+		spirvStages.push_back({static_cast<uint32_t>(i), std::move(spirv)});
+	}
+	if(spirvStages.empty())
+		return false;
+	for(auto &[stageIdx, spirv] : spirvStages) {
+		auto &stage = stages.at(stageIdx);
+		stage->stage = static_cast<prosper::ShaderStage>(stageIdx);
+		auto contentKey = calc_stage_content_key(stage->stage, spirv.data(), spirv.size());
+		auto shaderStageProgram = std::shared_ptr<GLShaderStage> {GLShaderStage::CreateFromSpirv(stage->stage, std::move(spirv))};
+		shaderStageProgram->SetContentKey(contentKey);
+		stage->program = shaderStageProgram;
+	}
+	return true;
+}
+void prosper::GLContext::SetSpirvShaderPath(const std::string &path) { m_spirvShaderPath = path; }
+void prosper::GLContext::SetShaderSourceDumpPath(const std::string &path) { m_shaderSourceDumpPath = path; }
 bool prosper::GLContext::InitializeShaderSources(prosper::Shader &shader, bool bReload, std::string &outInfoLog, std::string &outDebugInfoLog, prosper::ShaderStage &outErrStage, const std::string &prefixCode, const std::unordered_map<std::string, std::string> &definitions) const
 {
+	if(RequiresGLThreadRoundTrip())
+		return RunOnGLThread([&]() { return InitializeShaderSources(shader, bReload, outInfoLog, outDebugInfoLog, outErrStage, prefixCode, definitions); });
 	auto &stages = shader.GetStages();
-	std::vector<std::string> glslCodePerStage;
-	std::vector<prosper::ShaderStage> glslCodeStages;
-	if(GetParsedShaderSourceCode(shader, glslCodePerStage, glslCodeStages, outInfoLog, outDebugInfoLog, outErrStage, prefixCode, definitions) == false)
+	assign_shader_stages(shader);
+	// The CPU-side preprocessing may already have been done by PreprocessShaderSources
+	ParsedShaderSource source;
+	if(GetPreprocessedShaderSources(shader, source, outInfoLog, outDebugInfoLog, outErrStage, prefixCode, definitions, bReload) == false)
 		return false;
+	// Precompiled SPIR-V skips the GLSL compilation, as long as it matches the preprocessed source code.
+	// Reloading a shader always uses the GLSL code.
+	if(bReload == false && m_spirvShaderPath.empty() == false && GLAD_GL_VERSION_4_6 && LoadSpirvShaderStages(shader, source, prefixCode, definitions))
+		return true;
+	auto &glslCodeStages = source.glslCodeStages;
+	auto &contentKeys = source.contentKeys;
+	// Stages with specialization constants are compiled with the default values, the code with the specialization
+	// constants is kept for the variants
+	auto &glslCodePerStage = source.defaultGlslCodePerStage;
+	auto &specializationTemplates = source.glslCodePerStage;
+	for(auto i = decltype(glslCodePerStage.size()) {0u}; i < glslCodePerStage.size(); ++i) {
+		if(glslCodePerStage.at(i).empty() == false)
+			continue;
+		glslCodePerStage.at(i) = std::move(specializationTemplates.at(i));
+		specializationTemplates.at(i).clear();
+	}
+
+	std::vector<ProgramStageKey> stageKeys;
+	stageKeys.reserve(glslCodePerStage.size());
+	for(auto i = decltype(glslCodePerStage.size()) {0u}; i < glslCodePerStage.size(); ++i)
+		stageKeys.push_back({glslCodeStages.at(i), contentKeys.at(i), {}});
+	auto hasProgramBinary = false;
+	if(m_programCache)
+		hasProgramBinary = m_programCache->Find(GLProgramCache::CalcProgramKey(calc_program_content_key(stageKeys), m_programCache->GetDriverHash())).has_value();
 
 	auto &logCallback = shader.GetLogCallback();
 	for(auto i = decltype(glslCodePerStage.size()) {0u}; i < glslCodePerStage.size(); ++i) {
 		auto stage = glslCodeStages.at(i);
-		std::shared_ptr<GLShaderStage> shaderStageProgram = GLShaderStage::Compile(stage, glslCodePerStage.at(i), outInfoLog);
+		std::shared_ptr<GLShaderStage> shaderStageProgram;
+		// Reloaded stages are always compiled again, since a shared stage may have failed to compile asynchronously
+		if(bReload == false) {
+			// Stages with identical code are compiled only once
+			std::scoped_lock lock {m_sharedShaderStagesMutex};
+			auto it = m_sharedShaderStages.find(contentKeys.at(i));
+			if(it != m_sharedShaderStages.end())
+				shaderStageProgram = it->second.lock();
+		}
+		if(shaderStageProgram) {
+			stages.at(pragma::math::to_integral(stage))->program = shaderStageProgram;
+			continue;
+		}
+		// If a program binary exists, compilation is skipped unless the binary is rejected when the pipeline is created.
+		// With deferred linking the stages are compiled when the first pipeline using them is linked, i.e. in link order.
+		// Stages with specialization constants are always deferred: Pipelines with specialization info link variants of the stage
+		// (see create_program), which are looked up in the program cache by their variant key, so the default-valued stage
+		// is only compiled if a pipeline without specialization info actually links it.
+		// Reloads are compiled synchronously, so syntax errors are reported by the reload.
+		if(bReload)
+			shaderStageProgram = GLShaderStage::Compile(stage, glslCodePerStage.at(i), outInfoLog);
+		else if(hasProgramBinary || IsPipelineLinkingDeferred() || specializationTemplates.at(i).empty() == false)
+			shaderStageProgram = GLShaderStage::CreateDeferred(stage, std::move(glslCodePerStage.at(i)));
+		else if(m_parallelShaderCompile) {
+			// Compile errors will be reported once the pipeline has been linked
+			shaderStageProgram = GLShaderStage::Submit(stage, glslCodePerStage.at(i), outInfoLog);
+		}
+		else
+			shaderStageProgram = GLShaderStage::Compile(stage, glslCodePerStage.at(i), outInfoLog);
 		if(shaderStageProgram == nullptr) {
 			outErrStage = stage;
 			return false;
 		}
+		shaderStageProgram->SetContentKey(contentKeys.at(i));
+		shaderStageProgram->SetSynchronous(bReload);
+		if(specializationTemplates.at(i).empty() == false)
+			shaderStageProgram->SetSpecializationTemplate(std::move(specializationTemplates.at(i)));
 		stages.at(pragma::math::to_integral(stage))->program = shaderStageProgram;
+		std::scoped_lock lock {m_sharedShaderStagesMutex};
+		add_shared_object(m_sharedShaderStages, contentKeys.at(i), shaderStageProgram);
 	}
 #if 0
 	// Output final shader code
@@ -430,7 +1458,15 @@ prosper::MemoryRequirements prosper::GLContext::GetMemoryRequirements(IImage &im
 }
 bool prosper::GLContext::WaitForCurrentSwapchainCommandBuffer(std::string &outErrMsg)
 {
-	Flush();
+	if(RequiresGLThreadRoundTrip())
+		return RunOnGLThread([&]() { return WaitForCurrentSwapchainCommandBuffer(outErrMsg); });
+	// Like in Vulkan, this waits for the frame that last used the slot which is about to be reused, so the
+	// frames in flight aren't serialized. DrawFrame waits for the same slot in WaitForFrameSlot.
+	auto &slot = m_frameSlots.at(m_frameSlotIndex);
+	if(slot.fence && glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, std::numeric_limits<GLuint64>::max()) == GL_WAIT_FAILED) {
+		outErrMsg = "Failed to wait for swapchain command buffer fence!";
+		return false;
+	}
 	return true;
 }
 uint64_t prosper::GLContext::ClampDeviceMemorySize(uint64_t size, float percentageOfGPUMemory, MemoryFeatureFlags featureFlags) const
@@ -462,15 +1498,47 @@ void prosper::GLContext::GetGLSLDefinitions(glsl::Definitions &outDef) const
 	outDef.layoutPushConstants = "std140, binding = 0"; // Index 0 is reserved for push constants
 	outDef.vertexIndex = "gl_VertexID";
 	outDef.instanceIndex = "gl_InstanceID";
+	outDef.apiScreenSpaceTransform = "mat4(1,0,0,0,0,-1,0,0,0,0,1,0,0,0,1,1) *T";
+	if(m_clipControlEnabled) {
+		// Depth range and y-axis inversion are handled by glClipControl
+		outDef.apiCoordTransform = "T";
+		outDef.apiDepthTransform = "T";
+		return;
+	}
 	// Matrix for converting depth range and y-axis inversion
 	outDef.apiCoordTransform = "mat4(1,0,0,0,0,-1,0,0,0,0,2,0,0,0,-1,1) *T"; // Matrix is inverse of mat4(1,0,0,0,0,-1,0,0,0,0,0.5,0,0,0,0.5,1)
-	outDef.apiScreenSpaceTransform = "mat4(1,0,0,0,0,-1,0,0,0,0,1,0,0,0,1,1) *T";
 	outDef.apiDepthTransform = "mat4(1,0,0,0,0,1,0,0,0,0,2,0,0,0,-1,1) *T"; // Matrix is inverse of mat4(1,0,0,0,0,1,0,0,0,0,0.5,0,0,0,0.5,1)
 }
 
 bool prosper::GLContext::SavePipelineCache()
 {
-	return false; // TODO
+	if(RequiresGLThreadRoundTrip())
+		return RunOnGLThread([&]() { return SavePipelineCache(); });
+	if(m_programCache == nullptr && m_pipelineUsageProfile == nullptr)
+		return false;
+	auto success = true;
+	if(m_programCache && m_programCache->Save() == false)
+		success = false;
+	if(m_pipelineUsageProfile && m_pipelineUsageProfile->Save() == false)
+		success = false;
+	return success;
+}
+void prosper::GLContext::SetProgramCachePath(const std::string &path)
+{
+	if(m_shaderManager) {
+		ValidationCallback(prosper::DebugMessageSeverityFlags::WarningBit, "The program cache path has to be changed before the context is initialized!");
+		return;
+	}
+	m_programCachePath = path;
+}
+void prosper::GLContext::SetPipelineUsageProfilePath(const std::string &path, uint64_t shaderSetHash)
+{
+	if(m_shaderManager) {
+		ValidationCallback(prosper::DebugMessageSeverityFlags::WarningBit, "The pipeline usage profile path has to be changed before the context is initialized!");
+		return;
+	}
+	m_pipelineUsageProfilePath = path;
+	m_shaderSetHash = shaderSetHash;
 }
 
 std::shared_ptr<prosper::IPrimaryCommandBuffer> prosper::GLContext::AllocatePrimaryLevelCommandBuffer(prosper::QueueFamilyType queueFamilyType, uint32_t &universalQueueFamilyIndex) { return GLPrimaryCommandBuffer::Create(*this, queueFamilyType); }
@@ -478,64 +1546,123 @@ std::shared_ptr<prosper::ISecondaryCommandBuffer> prosper::GLContext::AllocateSe
 std::shared_ptr<prosper::ICommandBufferPool> prosper::GLContext::CreateCommandBufferPool(prosper::QueueFamilyType queueFamilyType) { return GLCommandBufferPool::Create(*this, queueFamilyType); }
 void prosper::GLContext::SubmitCommandBuffer(prosper::ICommandBuffer &cmd, prosper::QueueFamilyType queueFamilyType, bool shouldBlock, prosper::IFence *fence)
 {
-	auto *glFence = static_cast<prosper::GLFence *>(fence);
-	if(glFence) {
-		if(shouldBlock)
-			glFence->Wait();
-		glFence->Reset();
+	// The value has to be reserved before the submission is handed to the GL thread
+	ReserveTimelineValue();
+	if(RequiresGLThreadRoundTrip())
+		return RunOnGLThread([&]() { ExecuteSubmission(cmd, shouldBlock, fence); });
+	ExecuteSubmission(cmd, shouldBlock, fence);
+}
+void prosper::GLContext::ExecuteSubmission(ICommandBuffer &cmd, bool shouldBlock, IFence *fence)
+{
+	auto &glCmd = dynamic_cast<GLCommandBuffer &>(cmd);
+	ExecuteCommandBuffer(glCmd);
+	auto timelineValue = SignalTimeline();
+	if(fence) {
+		auto &glFence = static_cast<prosper::GLFence &>(*fence);
+		glFence.Reset();
+		glFence.SetTimelineValue(timelineValue);
 	}
+	// Only the work up to this command buffer has to be waited for
+	if(shouldBlock)
+		glCmd.WaitForCompletion();
+	RetireTimelineSyncs();
+}
+void prosper::GLContext::ExecuteCommandBuffer(GLCommandBuffer &cmd)
+{
+	// With threaded submission the commands are executed now, otherwise they have already been executed while recording.
+	// Either way the completion fence is inserted after them.
+	if(cmd.IsRecordingDeferred())
+		GLCommandBuffer::ReplayCommands(cmd.TakeDeferredCommands(), cmd);
+	cmd.InsertCompletionFence();
+}
+bool prosper::GLContext::UploadBufferUpdates(GLBufferUpdateBatch &batch)
+{
+	if(m_stagingBuffer == nullptr)
+		m_stagingBuffer = std::make_unique<GLStagingBuffer>();
+	batch.Upload(*m_stagingBuffer);
+	return CheckResult();
+}
+void prosper::GLContext::DrainPipeline()
+{
+	++m_pipelineDrainCount;
+	glFinish();
 }
 
-prosper::PipelineID prosper::GLContext::AddPipeline(prosper::Shader &shader, PipelineID shaderPipelineId, std::shared_ptr<GLShaderProgram> program)
+prosper::PipelineID prosper::GLContext::AddPipeline(prosper::Shader &shader, PipelineID shaderPipelineId, std::shared_ptr<GLShaderProgram> program, std::vector<std::shared_ptr<GLShaderStage>> pendingStages, uint64_t stageKey)
 {
 	PipelineID pipelineId;
 	if(m_freePipelineIndices.empty() == false) {
 		auto idx = m_freePipelineIndices.front();
 		m_freePipelineIndices.pop();
-		m_pipelines.at(idx).program = program;
 		pipelineId = idx;
 	}
 	else {
 		m_pipelines.push_back({});
-		m_pipelines.back().program = program;
 		pipelineId = m_pipelines.size() - 1;
 	}
+	auto &pipelineData = m_pipelines.at(pipelineId);
+	pipelineData.program = program;
+	pipelineData.pendingStages = std::move(pendingStages);
+	pipelineData.shader = shader.GetHandle();
+	pipelineData.shaderPipelineId = shaderPipelineId;
+	pipelineData.stageKey = stageKey;
+	if(m_pipelineUsageProfile) {
+		// Pipelines that were bound earlier in the previous session are linked first
+		auto firstBindTime = m_pipelineUsageProfile->FindFirstBindTime(shader.GetIdentifier(), shaderPipelineId, stageKey);
+		if(firstBindTime)
+			pipelineData.linkPriority = std::numeric_limits<int32_t>::max() - static_cast<int32_t>(std::min<uint32_t>(*firstBindTime, std::numeric_limits<int32_t>::max() - 1));
+	}
+	if(pipelineData.pendingStages.empty() == false)
+		m_pipelineLinkQueue.insert({-pipelineData.linkPriority, pipelineId});
 	InitShaderPipeline(shader, pipelineId, shaderPipelineId);
 	AddShaderPipeline(shader, shaderPipelineId, pipelineId);
 	return pipelineId;
 }
 std::optional<prosper::PipelineID> prosper::GLContext::AddPipeline(prosper::Shader &shader, PipelineID shaderPipelineId, const prosper::ComputePipelineCreateInfo &createInfo, prosper::ShaderStageData &stage, PipelineID basePipelineId)
 {
-	auto program = GLShaderProgram::Create();
-	program->AttachShader(static_cast<GLShaderStage &>(*stage.program));
-	if(CheckResult() == false)
-		return {};
+	if(RequiresGLThreadRoundTrip())
+		return RunOnGLThread([&]() { return AddPipeline(shader, shaderPipelineId, createInfo, stage, basePipelineId); });
+	std::vector<std::shared_ptr<GLShaderStage>> stages {std::static_pointer_cast<GLShaderStage>(stage.program)};
+	auto stageKey = calc_pipeline_stage_key(stages);
+	auto synchronous = is_synchronous(stages);
+	if(IsPipelineLinkingDeferred() && synchronous == false)
+		return AddPipeline(shader, shaderPipelineId, nullptr, std::move(stages), stageKey);
 	std::string err;
-	if(program->Link(err) == false) {
+	auto program = create_program(m_programCache.get(), m_sharedPrograms, std::move(stages), createInfo, err);
+	if(program == nullptr || (synchronous && program->FinalizeLink(m_programCache.get(), err) == GLShaderProgram::Status::Failed)) {
 		ValidationCallback(prosper::DebugMessageSeverityFlags::ErrorBit, err);
-		return false;
+		return {};
 	}
-	return AddPipeline(shader, shaderPipelineId, program);
+	if(CheckResult() == false)
+		return {};
+	return AddPipeline(shader, shaderPipelineId, program, {}, stageKey);
 }
 std::optional<prosper::PipelineID> prosper::GLContext::AddPipeline(prosper::Shader &shader, PipelineID shaderPipelineId, const prosper::GraphicsPipelineCreateInfo &createInfo, IRenderPass &rp, prosper::ShaderStageData *shaderStageFs, prosper::ShaderStageData *shaderStageVs,
   prosper::ShaderStageData *shaderStageGs, prosper::ShaderStageData *shaderStageTc, prosper::ShaderStageData *shaderStageTe, SubPassID subPassId, PipelineID basePipelineId)
 {
-	auto program = GLShaderProgram::Create();
+	if(RequiresGLThreadRoundTrip())
+		return RunOnGLThread([&]() { return AddPipeline(shader, shaderPipelineId, createInfo, rp, shaderStageFs, shaderStageVs, shaderStageGs, shaderStageTc, shaderStageTe, subPassId, basePipelineId); });
+	std::vector<std::shared_ptr<GLShaderStage>> stages;
+	stages.reserve(5);
 	for(auto *shaderStage : std::initializer_list<prosper::ShaderStageData *> {shaderStageFs, shaderStageVs, shaderStageGs, shaderStageTc, shaderStageTe}) {
 		if(shaderStage == nullptr)
 			continue;
-		program->AttachShader(static_cast<GLShaderStage &>(*shaderStage->program));
-		if(CheckResult() == false)
-			return {};
+		stages.push_back(std::static_pointer_cast<GLShaderStage>(shaderStage->program));
 	}
-	if(CheckResult() == false)
-		return {};
+	auto stageKey = calc_pipeline_stage_key(stages);
+	auto synchronous = is_synchronous(stages);
+	if(IsPipelineLinkingDeferred() && synchronous == false)
+		return AddPipeline(shader, shaderPipelineId, nullptr, std::move(stages), stageKey);
+	// Linking happens asynchronously if supported (see IsPipelineReady), unless the shader is being reloaded
 	std::string err;
-	if(program->Link(err) == false) {
+	auto program = create_program(m_programCache.get(), m_sharedPrograms, std::move(stages), createInfo, err);
+	if(program == nullptr || (synchronous && program->FinalizeLink(m_programCache.get(), err) == GLShaderProgram::Status::Failed)) {
 		ValidationCallback(prosper::DebugMessageSeverityFlags::ErrorBit, err);
 		return {};
 	}
-	return AddPipeline(shader, shaderPipelineId, program);
+	if(CheckResult() == false)
+		return {};
+	return AddPipeline(shader, shaderPipelineId, program, {}, stageKey);
 }
 
 std::optional<uint32_t> prosper::GLContext::ShaderPipelineDescSetBindingIndexToBindingPoint(PipelineID pipelineId, uint32_t setIdx, uint32_t bindingIdx) const
@@ -581,20 +1708,72 @@ void prosper::GLContext::InitShaderPipeline(prosper::Shader &shader, PipelineID
 
 bool prosper::GLContext::ClearPipeline(bool graphicsShader, PipelineID pipelineId)
 {
+	if(RequiresGLThreadRoundTrip())
+		return RunOnGLThread([&]() { return ClearPipeline(graphicsShader, pipelineId); });
+	m_pipelineLinkQueue.erase({-m_pipelines.at(pipelineId).linkPriority, pipelineId});
+	// The program may be deleted, in which case its name can be reused
+	if(auto program = GetPipelineProgram(pipelineId); program && *program == m_activeProgram)
+		UseProgram(0);
 	m_pipelines.at(pipelineId) = {};
 	m_freePipelineIndices.push(pipelineId);
 	return true;
 }
 
-void prosper::GLContext::Flush() { glFlush(); }
+void prosper::GLContext::Flush()
+{
+	if(RequiresGLThreadRoundTrip())
+		return RunOnGLThread([this]() { Flush(); });
+	glFlush();
+}
 prosper::Result prosper::GLContext::WaitForFence(const IFence &fence, uint64_t timeout) const
 {
-
-	return Result::ErrorDeviceLost; // TODO
+	if(RequiresGLThreadRoundTrip())
+		return RunOnGLThread([&]() { return WaitForFence(fence, timeout); });
+	return static_cast<const GLFence &>(fence).Wait(timeout);
 }
 prosper::Result prosper::GLContext::WaitForFences(const std::vector<IFence *> &fences, bool waitAll, uint64_t timeout) const
 {
-	return Result::ErrorDeviceLost; // TODO
+	if(RequiresGLThreadRoundTrip())
+		return RunOnGLThread([&]() { return WaitForFences(fences, waitAll, timeout); });
+	if(fences.empty())
+		return Result::Success;
+	std::optional<std::chrono::steady_clock::time_point> deadline {};
+	if(timeout != std::numeric_limits<uint64_t>::max())
+		deadline = std::chrono::steady_clock::now() + std::chrono::nanoseconds {timeout};
+	auto getRemainingTime = [&deadline]() -> uint64_t {
+		if(!deadline)
+			return std::numeric_limits<uint64_t>::max();
+		auto remaining = std::chrono::duration_cast<std::chrono::nanoseconds>(*deadline - std::chrono::steady_clock::now()).count();
+		return (remaining > 0) ? static_cast<uint64_t>(remaining) : 0;
+	};
+	if(waitAll) {
+		for(auto *fence : fences) {
+			auto res = static_cast<GLFence *>(fence)->Wait(getRemainingTime());
+			if(res != Result::Success)
+				return res;
+		}
+		return Result::Success;
+	}
+
+	// glClientWaitSync can only wait for a single sync object, so the fences are polled. In between polls we block on the
+	// first fence for a time slice that grows with every iteration.
+	constexpr uint64_t minTimeSlice = 50'000;    // 50us
+	constexpr uint64_t maxTimeSlice = 1'000'000; // 1ms
+	auto timeSlice = minTimeSlice;
+	for(;;) {
+		for(auto *fence : fences) {
+			auto res = static_cast<GLFence *>(fence)->Poll();
+			if(res != Result::Timeout)
+				return res;
+		}
+		auto remainingTime = getRemainingTime();
+		if(remainingTime == 0)
+			return Result::Timeout;
+		auto res = static_cast<GLFence *>(fences.front())->Wait(std::min(timeSlice, remainingTime));
+		if(res != Result::Timeout)
+			return res;
+		timeSlice = std::min(timeSlice * 2, maxTimeSlice);
+	}
 }
 std::shared_ptr<prosper::IQueryPool> prosper::GLContext::CreateQueryPool(QueryType queryType, uint32_t maxConcurrentQueries)
 {
@@ -622,7 +1801,13 @@ bool prosper::GLContext::QueryResult(const Query &query, uint64_t &r) const
 }
 void prosper::GLContext::DrawFrame(const std::function<void()> &drawFrame) //move to GLWindow?
 {
-	// TODO: Wait for fences?
+	// The GL thread may still be executing the previous frame
+	if(m_glThread)
+		AcquireGLContext();
+	// Limits how far the CPU can get ahead of the GPU. The resources of the frame that last used this slot can be released afterwards.
+	WaitForFrameSlot(m_frameSlotIndex);
+	// Coroutines waiting for GPU work that has finished by now continue before the frame is recorded
+	ResumeCompletedAwaiters();
 	auto &glWindow = static_cast<GLWindow &>(*m_window);
 	glWindow.m_lastAcquiredSwapchainImageIndex = (glWindow.m_lastAcquiredSwapchainImageIndex == 1) ? 0 : 1;
 	ClearKeepAliveResources();
@@ -632,11 +1817,15 @@ void prosper::GLContext::DrawFrame(const std::function<void()> &drawFrame) //mov
 	cmdBuffer->StartRecording(false, true);
 	pragma::math::set_flag(m_stateFlags, StateFlags::IsRecording);
 	pragma::math::set_flag(m_stateFlags, StateFlags::Idle, false);
+	// Scheduled updates are uploaded together instead of one by one
+	auto &glDrawCmd = dynamic_cast<GLCommandBuffer &>(*cmdBuffer);
+	glDrawCmd.BeginBufferUpdateBatch();
 	while(m_scheduledBufferUpdates.empty() == false) {
 		auto &f = m_scheduledBufferUpdates.front();
 		f(*cmdBuffer);
 		m_scheduledBufferUpdates.pop();
 	}
+	glDrawCmd.EndBufferUpdateBatch();
 	drawFrame();
 
 	/* Close the recording process */
@@ -644,10 +1833,37 @@ void prosper::GLContext::DrawFrame(const std::function<void()> &drawFrame) //mov
 	cmdBuffer->StopRecording();
 	// TODO: Submit command buffer?
 
+	auto slotIndex = m_frameSlotIndex;
+	m_frameSlotIndex = (m_frameSlotIndex + 1) % m_frameSlots.size();
+	ReserveTimelineValue();
+	if(m_glThread == nullptr) {
+		PresentFrame(slotIndex);
+		return;
+	}
+	// The frame is executed on the GL thread while the caller continues
+	auto commands = glDrawCmd.TakeDeferredCommands();
+	ReleaseGLContext();
+	m_glThread->Push([this, cmdBuffer = cmdBuffer, commands = std::move(commands), slotIndex]() {
+		GLCommandBuffer::ReplayCommands(commands, dynamic_cast<GLCommandBuffer &>(*cmdBuffer));
+		PresentFrame(slotIndex);
+	});
+}
+void prosper::GLContext::PresentFrame(uint32_t slotIndex)
+{
 	//if(m_glfwWindow->IsVSyncEnabled())
 	(*m_window)->SwapBuffers();
 	//else
 	//	glFlush();
+	m_frameSlots.at(slotIndex).fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	SignalTimeline();
+	RetireTimelineSyncs();
+	// Objects released up to this point are deleted once the GPU has finished the frame
+	GLDeletionQueue::Get().Retire(slotIndex);
+	m_lastFramePipelineDrainCount = m_pipelineDrainCount.exchange(0);
+
+	// Pipelines with deferred linking are linked while the GPU is busy with the frame
+	ProcessPipelineLinkQueue();
+	ProcessPipelineWarmUpQueue();
 }
 bool prosper::GLContext::Submit(ICommandBuffer &cmdBuf, bool shouldBlock, IFence *optFence)
 {
@@ -655,11 +1871,10 @@ bool prosper::GLContext::Submit(ICommandBuffer &cmdBuf, bool shouldBlock, IFence
 }
 std::expected<void, std::string> prosper::GLContext::Initialize(const CreateInfo &createInfo)
 {
-	auto cpy = createInfo;
-	cpy.maxNumberOfFramesInFlight = 1;
-	auto res = IPrContext::Initialize(cpy);
+	auto res = IPrContext::Initialize(createInfo);
 	if(!res)
 		return std::unexpected {res.error()};
+	m_frameSlots.resize(pragma::math::max(static_cast<uint32_t>(createInfo.maxNumberOfFramesInFlight), static_cast<uint32_t>(1)));
 	m_hShaderFlip = m_shaderManager->GetShader("flip_image");
 	return {};
 }
@@ -667,14 +1882,162 @@ std::expected<void, std::string> prosper::GLContext::Initialize(const CreateInfo
 prosper::ShaderBlit *prosper::GLContext::GetBlitShader() const { return static_cast<prosper::ShaderBlit *>(m_hShaderBlit.get()); }
 prosper::ShaderFlipImage *prosper::GLContext::GetFlipShader() const { return static_cast<prosper::ShaderFlipImage *>(m_hShaderFlip.get()); }
 
-void prosper::GLContext::DoKeepResourceAliveUntilPresentationComplete(const std::shared_ptr<void> &resource) {}
+void prosper::GLContext::DoKeepResourceAliveUntilPresentationComplete(const std::shared_ptr<void> &resource) { m_frameSlots.at(m_frameSlotIndex).keepAliveResources.push_back(resource); }
 void prosper::GLContext::DoWaitIdle()
 {
 	if(!pragma::math::is_flag_set(m_stateFlags, StateFlags::Initialized))
 		return;
-	glFinish();
+	if(RequiresGLThreadRoundTrip())
+		return RunOnGLThread([this]() { DoWaitIdle(); });
+	DrainPipeline();
+	for(auto i = decltype(m_frameSlots.size()) {0u}; i < m_frameSlots.size(); ++i)
+		WaitForFrameSlot(i);
+	GLDeletionQueue::Get().CollectAll();
+}
+void prosper::GLContext::WaitForFrameSlot(uint32_t slotIndex)
+{
+	auto &slot = m_frameSlots.at(slotIndex);
+	if(slot.fence) {
+		glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, std::numeric_limits<GLuint64>::max());
+		glDeleteSync(slot.fence);
+		slot.fence = nullptr;
+	}
+	slot.keepAliveResources.clear();
+	GLDeletionQueue::Get().Collect(slotIndex);
+	RetireTimelineSyncs();
+}
+void prosper::GLContext::ReserveTimelineValue() { m_submittedTimelineValue.fetch_add(1, std::memory_order_acq_rel); }
+uint64_t prosper::GLContext::SignalTimeline()
+{
+	// Submissions are executed in the order in which they were handed to the GL thread, so every
+	// value up to the submitted value at the time of a submission is assigned no later than that submission.
+	m_timelineSyncs.push_back({++m_signaledTimelineValue, glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0)});
+	return m_signaledTimelineValue;
+}
+void prosper::GLContext::RetireTimelineSyncs(bool wait) const
+{
+	auto completedValue = m_completedTimelineValue.load(std::memory_order_relaxed);
+	while(m_timelineSyncs.empty() == false) {
+		auto &timelineSync = m_timelineSyncs.front();
+		auto res = glClientWaitSync(timelineSync.sync, wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0, wait ? std::numeric_limits<GLuint64>::max() : 0);
+		if(res == GL_TIMEOUT_EXPIRED)
+			break;
+		// Sync objects are signaled in order, so the front one is always the oldest
+		completedValue = timelineSync.value;
+		glDeleteSync(timelineSync.sync);
+		m_timelineSyncs.pop_front();
+	}
+	if(completedValue == m_completedTimelineValue.load(std::memory_order_relaxed))
+		return;
+	{
+		std::scoped_lock lock {m_timelineMutex};
+		m_completedTimelineValue.store(completedValue, std::memory_order_release);
+	}
+	m_timelineCondition.notify_all();
+}
+bool prosper::GLContext::WaitTimelineValue(uint64_t value, uint64_t timeout) const
+{
+	if(GetCompletedTimelineValue() >= value)
+		return true;
+	if(glfwGetCurrentContext() != nullptr) {
+		// The context is owned by this thread, so the sync objects can be waited on directly
+		if(value > m_signaledTimelineValue)
+			return false;
+		auto t = std::chrono::steady_clock::now();
+		while(m_timelineSyncs.empty() == false && m_timelineSyncs.front().value <= value) {
+			auto elapsed = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - t).count());
+			if(elapsed >= timeout || glClientWaitSync(m_timelineSyncs.front().sync, GL_SYNC_FLUSH_COMMANDS_BIT, timeout - elapsed) == GL_TIMEOUT_EXPIRED)
+				break;
+			RetireTimelineSyncs();
+		}
+		return GetCompletedTimelineValue() >= value;
+	}
+	std::unique_lock lock {m_timelineMutex};
+	auto isComplete = [this, value]() { return m_completedTimelineValue.load(std::memory_order_acquire) >= value; };
+	if(timeout == std::numeric_limits<uint64_t>::max()) {
+		m_timelineCondition.wait(lock, isComplete);
+		return true;
+	}
+	return m_timelineCondition.wait_for(lock, std::chrono::nanoseconds {timeout}, isComplete);
+}
+void prosper::GLContext::SetThreadedSubmissionEnabled(bool enabled)
+{
+	if(enabled == IsThreadedSubmissionEnabled())
+		return;
+	if(enabled) {
+		m_glThread = std::make_unique<GLThread>(const_cast<GLFWwindow *>((*m_window)->GetGLFWWindow()));
+		ReleaseGLContext();
+		return;
+	}
+	AcquireGLContext();
+	{
+		std::scoped_lock lock {m_glContextMutex};
+		m_glThread = nullptr;
+		m_glContextAcquired = false;
+	}
+	m_glContextCondition.notify_all();
+}
+bool prosper::GLContext::RequiresGLThreadRoundTrip() const { return m_glThread && glfwGetCurrentContext() == nullptr; }
+void prosper::GLContext::ExecuteOnGLThread(const std::function<void()> &func) const
+{
+	if(RequiresGLThreadRoundTrip() == false) {
+		func();
+		return;
+	}
+	// The GL thread doesn't own the context while it has been acquired by another thread. The lock is held until
+	// the call has completed, so the context can't be acquired while the GL thread is executing the function.
+	std::unique_lock lock {m_glContextMutex};
+	m_glContextCondition.wait(lock, [this]() { return m_glContextAcquired == false; });
+	if(m_glThread == nullptr) {
+		// Threaded submission has been disabled in the meantime
+		func();
+		return;
+	}
+	m_glThread->Call(func);
+}
+void prosper::GLContext::AcquireGLContext()
+{
+	if(glfwGetCurrentContext() != nullptr)
+		return;
+	std::scoped_lock lock {m_glContextMutex};
+	m_glThread->Call([]() { glfwMakeContextCurrent(nullptr); });
+	glfwMakeContextCurrent(m_glThread->GetWindow());
+	m_glContextAcquired = true;
+}
+void prosper::GLContext::ReleaseGLContext()
+{
+	{
+		std::scoped_lock lock {m_glContextMutex};
+		glfwMakeContextCurrent(nullptr);
+		m_glThread->Push([window = m_glThread->GetWindow()]() { glfwMakeContextCurrent(window); });
+		m_glContextAcquired = false;
+	}
+	m_glContextCondition.notify_all();
+}
+void prosper::GLContext::SetMaxFramesAhead(uint32_t count)
+{
+	if(RequiresGLThreadRoundTrip())
+		return RunOnGLThread([&]() { SetMaxFramesAhead(count); });
+	count = pragma::math::max(count, static_cast<uint32_t>(1));
+	if(count == m_frameSlots.size())
+		return;
+	// Resources of the removed slots may still be in use
+	for(auto i = decltype(m_frameSlots.size()) {0u}; i < m_frameSlots.size(); ++i)
+		WaitForFrameSlot(i);
+	m_frameSlots.resize(count);
+	m_frameSlotIndex = 0;
+}
+void prosper::GLContext::DoFlushCommandBuffer(ICommandBuffer &cmd)
+{
+	if(RequiresGLThreadRoundTrip())
+		return RunOnGLThread([this, &cmd]() { DoFlushCommandBuffer(cmd); });
+	// Commands that haven't been submitted yet are covered by a new completion fence, work that
+	// has been issued after the command buffer was submitted doesn't have to be waited for
+	auto &glCmd = dynamic_cast<GLCommandBuffer &>(cmd);
+	if(glCmd.IsRecordingDeferred() || glCmd.HasCompletionFence() == false)
+		ExecuteCommandBuffer(glCmd);
+	glCmd.WaitForCompletion();
 }
-void prosper::GLContext::DoFlushCommandBuffer(ICommandBuffer &cmd) { glFinish(); }
 void prosper::GLContext::ReloadSwapchain()
 {
 	WaitIdle();
@@ -697,11 +2060,21 @@ std::expected<void, std::string> prosper::GLContext::InitAPI(const CreateInfo &c
 
 	if(!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
 		return std::unexpected {"Failed to initialize GLAD"};
+	GLDeletionQueue::Get().Activate();
 
 	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
 	glPixelStorei(GL_PACK_ALIGNMENT, 1);
 
 	glEnable(GL_CLIP_DISTANCE0);
+	InitParallelShaderCompile();
+	if(m_clipControlEnabled) {
+		if(GLAD_GL_VERSION_4_5)
+			glClipControl(GL_UPPER_LEFT, GL_ZERO_TO_ONE);
+		else {
+			ValidationCallback(prosper::DebugMessageSeverityFlags::WarningBit, "Clip control requires OpenGL 4.5, which is not supported by this device! Falling back to coordinate transforms in shaders...");
+			m_clipControlEnabled = false;
+		}
+	}
 	if(IsValidationEnabled()) {
 		glEnable(GL_DEBUG_OUTPUT);
 		glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
@@ -753,6 +2126,8 @@ std::expected<void, std::string> prosper::GLContext::InitAPI(const CreateInfo &c
 		  this);
 	}
 
+	InitProgramCache();
+	InitPipelineUsageProfile();
 	m_shaderManager = std::make_unique<ShaderManager>(*this);
 	InitPushConstantBuffer();
 	InitTemporaryBuffer();
@@ -761,6 +2136,55 @@ std::expected<void, std::string> prosper::GLContext::InitAPI(const CreateInfo &c
 	return {};
 }
 
+void prosper::GLContext::SetClipControlEnabled(bool enabled)
+{
+	if(m_shaderManager) {
+		// Shaders have already been compiled with the previous coordinate transforms
+		ValidationCallback(prosper::DebugMessageSeverityFlags::WarningBit, "Clip control has to be changed before the context is initialized!");
+		return;
+	}
+	m_clipControlEnabled = enabled;
+}
+
+void prosper::GLContext::InitParallelShaderCompile()
+{
+	PFNGLMAXSHADERCOMPILERTHREADSKHRPROC maxShaderCompilerThreads = nullptr;
+	if(glfwExtensionSupported("GL_KHR_parallel_shader_compile"))
+		maxShaderCompilerThreads = reinterpret_cast<PFNGLMAXSHADERCOMPILERTHREADSKHRPROC>(glfwGetProcAddress("glMaxShaderCompilerThreadsKHR"));
+	else if(glfwExtensionSupported("GL_ARB_parallel_shader_compile"))
+		maxShaderCompilerThreads = reinterpret_cast<PFNGLMAXSHADERCOMPILERTHREADSKHRPROC>(glfwGetProcAddress("glMaxShaderCompilerThreadsARB"));
+	m_parallelShaderCompile = (maxShaderCompilerThreads != nullptr);
+	if(!m_parallelShaderCompile)
+		return;
+	// Let the driver decide how many threads to use
+	maxShaderCompilerThreads(std::numeric_limits<GLuint>::max());
+}
+
+void prosper::GLContext::InitPipelineUsageProfile()
+{
+	if(m_pipelineUsageProfilePath.empty())
+		return;
+	// The stage keys depend on the clip control mode
+	auto seed = GetShaderKeySeed();
+	m_pipelineUsageProfile = GLPipelineUsageProfile::Load(m_pipelineUsageProfilePath, util::hash_fnv1a(&seed, sizeof(seed), util::hash_fnv1a(&m_shaderSetHash, sizeof(m_shaderSetHash))));
+}
+void prosper::GLContext::InitProgramCache()
+{
+	if(m_programCachePath.empty())
+		return;
+	GLint numBinaryFormats = 0;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &numBinaryFormats);
+	if(numBinaryFormats == 0)
+		return; // Program binaries are not supported by the driver
+	// Program binaries are only compatible with the driver they were created with
+	auto getString = [](GLenum name) -> std::string {
+		auto *str = glGetString(name);
+		return str ? reinterpret_cast<const char *>(str) : "";
+	};
+	auto driverIdentifier = getString(GL_VENDOR) + '\n' + getString(GL_RENDERER) + '\n' + getString(GL_VERSION);
+	m_programCache = GLProgramCache::Load(m_programCachePath, driverIdentifier);
+}
+
 void prosper::GLContext::InitPushConstantBuffer()
 {
 	util::BufferCreateInfo bufCreateInfo {};
@@ -773,6 +2197,8 @@ void prosper::GLContext::InitPushConstantBuffer()
 
 std::shared_ptr<prosper::IBuffer> prosper::GLContext::CreateBuffer(const prosper::util::BufferCreateInfo &createInfo, const void *data)
 {
+	if(RequiresGLThreadRoundTrip())
+		return RunOnGLThread([&]() { return CreateBuffer(createInfo, data); });
 	GLuint buf;
 	glCreateBuffers(1, &buf);
 
@@ -842,6 +2268,8 @@ std::shared_ptr<prosper::IEvent> prosper::GLContext::CreateEvent() { return GLEv
 std::shared_ptr<prosper::IFence> prosper::GLContext::CreateFence(bool createSignalled) { return GLFence::Create(*this); }
 std::shared_ptr<prosper::ISampler> prosper::GLContext::CreateSampler(const prosper::util::SamplerCreateInfo &createInfo)
 {
+	if(RequiresGLThreadRoundTrip())
+		return RunOnGLThread([&]() { return CreateSampler(createInfo); });
 	GLuint sampler;
 	glCreateSamplers(1, &sampler);
 	return GLSampler::Create(*this, createInfo, sampler);
@@ -852,6 +2280,8 @@ std::shared_ptr<prosper::IImageView> prosper::GLContext::DoCreateImageView(const
 }
 std::shared_ptr<prosper::IImage> prosper::GLContext::CreateImage(const util::ImageCreateInfo &pcreateInfo, const std::function<const uint8_t *(uint32_t layer, uint32_t mipmap, uint32_t &dataSize, uint32_t &rowSize)> &getImageData)
 {
+	if(RequiresGLThreadRoundTrip())
+		return RunOnGLThread([&]() { return CreateImage(pcreateInfo, getImageData); });
 	auto createInfo = pcreateInfo;
 	if((createInfo.flags & prosper::util::ImageCreateInfo::Flags::Cubemap) != prosper::util::ImageCreateInfo::Flags::None)
 		createInfo.layers = 6u;
@@ -861,11 +2291,16 @@ std::shared_ptr<prosper::IRenderPass> prosper::GLContext::CreateRenderPass(const
 std::shared_ptr<prosper::IDescriptorSetGroup> prosper::GLContext::DoCreateDescriptorSetGroup(DescriptorSetCreateInfo &descSetInfo, size_t numDescSetGroups) { return GLDescriptorSetGroup::Create(*this, descSetInfo); }
 std::shared_ptr<prosper::ISwapCommandBufferGroup> prosper::GLContext::CreateSwapCommandBufferGroup(Window &window, bool allowMt, const std::string &debugName)
 {
-	// OpenGL does not support multi-threaded rendering
+	// GL calls can only be issued on the GL thread, but secondary command buffers only record their
+	// commands and are replayed on the GL thread, so they can be recorded on worker threads
+	if(allowMt)
+		return std::make_shared<MtSwapCommandBufferGroup>(window);
 	return std::make_shared<StSwapCommandBufferGroup>(window);
 }
 std::shared_ptr<prosper::IFramebuffer> prosper::GLContext::CreateFramebuffer(uint32_t width, uint32_t height, uint32_t layers, const std::vector<prosper::IImageView *> &attachments)
 {
+	if(RequiresGLThreadRoundTrip())
+		return RunOnGLThread([&]() { return CreateFramebuffer(width, height, layers, attachments); });
 	std::vector<std::shared_ptr<IImageView>> ptrAttachments {};
 	ptrAttachments.reserve(attachments.size());
 	for(auto *att : attachments)
@@ -877,6 +2312,8 @@ std::shared_ptr<prosper::IFramebuffer> prosper::GLContext::CreateFramebuffer(uin
 std::shared_ptr<prosper::IRenderBuffer> prosper::GLContext::CreateRenderBuffer(const prosper::GraphicsPipelineCreateInfo &pipelineCreateInfo, const std::vector<prosper::IBuffer *> &buffers, const std::vector<prosper::DeviceSize> &offsets,
   const std::optional<IndexBufferInfo> &indexBufferInfo)
 {
+	if(RequiresGLThreadRoundTrip())
+		return RunOnGLThread([&]() { return CreateRenderBuffer(pipelineCreateInfo, buffers, offsets, indexBufferInfo); });
 	return std::static_pointer_cast<prosper::IRenderBuffer>(GLRenderBuffer::Create(*this, pipelineCreateInfo, buffers, offsets, indexBufferInfo));
 }
 bool prosper::GLContext::BindVertexBuffers(const prosper::GraphicsPipelineCreateInfo &pipelineCreateInfo, const std::vector<IBuffer *> &buffers, uint32_t startBinding, const std::vector<DeviceSize> &offsets, uint32_t *optOutAbsAttrId)
@@ -961,3 +2398,116 @@ bool prosper::GLContext::BindVertexBuffers(const prosper::GraphicsPipelineCreate
 		*optOutAbsAttrId = absAttrId;
 	return CheckResult();
 }
+
+// Buffer that the GPU writes readback data into, it's mapped once the GPU is done
+static std::shared_ptr<GLuint> create_readback_buffer(uint64_t size)
+{
+	std::shared_ptr<GLuint> buffer {new GLuint {0}, [](GLuint *buffer) {
+		                                prosper::GLDeletionQueue::Get().Enqueue(prosper::GLObjectType::Buffer, *buffer);
+		                                delete buffer;
+	                                }};
+	glCreateBuffers(1, buffer.get());
+	glNamedBufferStorage(*buffer, size, nullptr, GL_MAP_READ_BIT | GL_CLIENT_STORAGE_BIT);
+	return buffer;
+}
+static std::function<std::vector<uint8_t>()> get_readback_result(prosper::GLContext &context, std::shared_ptr<GLuint> buffer, uint64_t size)
+{
+	return [&context, buffer = std::move(buffer), size]() {
+		std::vector<uint8_t> data;
+		context.RunOnGLThread([&]() {
+			auto *ptr = glMapNamedBufferRange(*buffer, 0, size, GL_MAP_READ_BIT);
+			if(ptr == nullptr)
+				return;
+			data.resize(size);
+			std::memcpy(data.data(), ptr, size);
+			if(glUnmapNamedBuffer(*buffer) == GL_FALSE)
+				data.clear();
+		});
+		return data;
+	};
+}
+prosper::GLGpuAwaitable<bool> prosper::GLContext::UploadAsync(IBuffer &buffer, uint64_t offset, uint64_t size, const void *data)
+{
+	// The value has to be reserved before the operation is handed to the GL thread, every reserved value has to be signaled
+	ReserveTimelineValue();
+	auto success = false;
+	auto value = RunOnGLThread([&]() {
+		auto &glBuffer = buffer.GetAPITypeRef<GLBuffer>();
+		glNamedBufferSubData(glBuffer.GetGLBuffer(), glBuffer.GetStartOffset() + offset, size, data);
+		success = CheckResult();
+		return SignalTimeline();
+	});
+	return {m_gpuScheduler, value, [success]() { return success; }};
+}
+prosper::GLGpuAwaitable<bool> prosper::GLContext::UploadAsync(IImage &img, uint64_t size, const void *data, uint32_t layerIndex, uint32_t mipLevel)
+{
+	ReserveTimelineValue();
+	auto success = false;
+	auto value = RunOnGLThread([&]() {
+		success = static_cast<GLImage &>(img).WriteImageData(0, 0, img.GetWidth(mipLevel), img.GetHeight(mipLevel), layerIndex, mipLevel, size, static_cast<const uint8_t *>(data));
+		return SignalTimeline();
+	});
+	return {m_gpuScheduler, value, [success]() { return success; }};
+}
+prosper::GLGpuAwaitable<std::vector<uint8_t>> prosper::GLContext::ReadbackAsync(IBuffer &buffer, uint64_t offset, uint64_t size)
+{
+	ReserveTimelineValue();
+	std::shared_ptr<GLuint> readbackBuffer;
+	auto value = RunOnGLThread([&]() {
+		readbackBuffer = create_readback_buffer(size);
+		auto &glBuffer = buffer.GetAPITypeRef<GLBuffer>();
+		glCopyNamedBufferSubData(glBuffer.GetGLBuffer(), *readbackBuffer, glBuffer.GetStartOffset() + offset, 0, size);
+		if(CheckResult() == false)
+			readbackBuffer = nullptr;
+		return SignalTimeline();
+	});
+	if(readbackBuffer == nullptr)
+		return {m_gpuScheduler, value};
+	return {m_gpuScheduler, value, get_readback_result(*this, std::move(readbackBuffer), size)};
+}
+prosper::GLGpuAwaitable<std::vector<uint8_t>> prosper::GLContext::ReadbackAsync(IImage &img, uint32_t layerIndex, uint32_t mipLevel)
+{
+	ReserveTimelineValue();
+	std::shared_ptr<GLuint> readbackBuffer;
+	GLint size = 0;
+	auto value = RunOnGLThread([&]() {
+		auto &glImg = static_cast<GLImage &>(img);
+		auto w = img.GetWidth(mipLevel);
+		auto h = img.GetHeight(mipLevel);
+		auto compressed = util::is_compressed_format(img.GetFormat());
+		if(compressed) {
+			glGetTextureLevelParameteriv(glImg.GetGLImage(), mipLevel, GL_TEXTURE_COMPRESSED_IMAGE_SIZE, &size);
+			size /= glImg.GetLayerCount();
+		}
+		else
+			size = w * h * util::get_byte_size(img.GetFormat());
+		readbackBuffer = create_readback_buffer(size);
+		// With a pixel pack buffer bound, the data is written into the buffer at the specified offset
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, *readbackBuffer);
+		if(compressed)
+			glGetCompressedTextureSubImage(glImg.GetGLImage(), mipLevel, 0, 0, layerIndex, w, h, 1, size, nullptr);
+		else {
+			GLboolean normalized;
+			auto imgFormatType = util::to_opengl_image_format_type(glImg.GetFormat(), normalized);
+			glGetTextureSubImage(glImg.GetGLImage(), mipLevel, 0, 0, layerIndex, w, h, 1, glImg.GetPixelDataFormat(), imgFormatType, size, nullptr);
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		if(CheckResult() == false)
+			readbackBuffer = nullptr;
+		return SignalTimeline();
+	});
+	if(readbackBuffer == nullptr)
+		return {m_gpuScheduler, value};
+	return {m_gpuScheduler, value, get_readback_result(*this, std::move(readbackBuffer), size)};
+}
+prosper::GLGpuAwaitable<> prosper::GLContext::AwaitFence(const IFence &fence)
+{
+	auto timelineValue = static_cast<const GLFence &>(fence).GetTimelineValue();
+	return AwaitTimelineValue((timelineValue != 0) ? timelineValue : (GetSubmittedTimelineValue() + 1));
+}
+void prosper::GLContext::ResumeCompletedAwaiters()
+{
+	if(RequiresGLThreadRoundTrip() == false)
+		RetireTimelineSyncs();
+	m_gpuScheduler.Resume();
+}
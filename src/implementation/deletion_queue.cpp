@@ -0,0 +1,147 @@
+// SPDX-FileCopyrightText: (c) 2020 Silverlan <opensource@pragma-engine.com>
+// SPDX-License-Identifier: MIT
+
+module;
+
+#include "opengl_api.hpp"
+
+module pragma.prosper.opengl;
+
+import :deletion_queue;
+
+using namespace prosper;
+
+GLDeletionQueue &GLDeletionQueue::Get()
+{
+	static GLDeletionQueue queue;
+	return queue;
+}
+GLDeletionQueue::~GLDeletionQueue()
+{
+	// The GL context no longer exists at this point, only the nodes are released
+	auto *node = m_head.exchange(nullptr);
+	while(node) {
+		auto *next = node->next;
+		delete node;
+		node = next;
+	}
+}
+void GLDeletionQueue::Activate()
+{
+	// Objects that were released while no context existed must not be deleted by the new one
+	TakeAll();
+	m_retired.clear();
+	m_active = true;
+}
+void GLDeletionQueue::Deactivate()
+{
+	m_active = false;
+	TakeAll();
+	m_retired.clear();
+}
+void GLDeletionQueue::Enqueue(GLObjectType type, GLuint name)
+{
+	if(name == 0 || !m_active.load(std::memory_order_relaxed))
+		return;
+	Push({type, name, nullptr});
+}
+void GLDeletionQueue::Enqueue(GLsync sync)
+{
+	if(sync == nullptr || !m_active.load(std::memory_order_relaxed))
+		return;
+	Push({GLObjectType::Sync, 0, sync});
+}
+void GLDeletionQueue::Push(const Object &object)
+{
+	auto *node = new Node {object, m_head.load(std::memory_order_relaxed)};
+	while(!m_head.compare_exchange_weak(node->next, node, std::memory_order_release, std::memory_order_relaxed))
+		;
+}
+std::vector<GLDeletionQueue::Object> GLDeletionQueue::TakeAll()
+{
+	// The consumer takes the entire list at once, so there is no contention with the producers beyond the exchange
+	auto *node = m_head.exchange(nullptr, std::memory_order_acquire);
+	std::vector<Object> objects;
+	while(node) {
+		objects.push_back(node->object);
+		auto *next = node->next;
+		delete node;
+		node = next;
+	}
+	std::reverse(objects.begin(), objects.end());
+	return objects;
+}
+void GLDeletionQueue::Retire(uint32_t slotIndex)
+{
+	auto objects = TakeAll();
+	if(objects.empty())
+		return;
+	if(slotIndex >= m_retired.size())
+		m_retired.resize(slotIndex + 1);
+	auto &retired = m_retired[slotIndex];
+	retired.insert(retired.end(), objects.begin(), objects.end());
+}
+void GLDeletionQueue::Collect(uint32_t slotIndex)
+{
+	if(slotIndex >= m_retired.size())
+		return;
+	Delete(m_retired[slotIndex]);
+}
+void GLDeletionQueue::CollectAll()
+{
+	for(auto &retired : m_retired)
+		Delete(retired);
+	auto objects = TakeAll();
+	Delete(objects);
+}
+void GLDeletionQueue::Delete(std::vector<Object> &objects)
+{
+	if(objects.empty())
+		return;
+	// Objects of the same type are deleted with a single call where possible
+	std::stable_sort(objects.begin(), objects.end(), [](const Object &a, const Object &b) { return a.type < b.type; });
+	std::vector<GLuint> names;
+	names.reserve(objects.size());
+	for(auto it = objects.begin(); it != objects.end();) {
+		auto type = it->type;
+		auto itEnd = std::find_if(it, objects.end(), [type](const Object &o) { return o.type != type; });
+		names.clear();
+		for(auto itObj = it; itObj != itEnd; ++itObj)
+			names.push_back(itObj->name);
+		auto n = static_cast<GLsizei>(names.size());
+		switch(type) {
+		case GLObjectType::Buffer:
+			glDeleteBuffers(n, names.data());
+			break;
+		case GLObjectType::Texture:
+			glDeleteTextures(n, names.data());
+			break;
+		case GLObjectType::Renderbuffer:
+			glDeleteRenderbuffers(n, names.data());
+			break;
+		case GLObjectType::Framebuffer:
+			glDeleteFramebuffers(n, names.data());
+			break;
+		case GLObjectType::Sampler:
+			glDeleteSamplers(n, names.data());
+			break;
+		case GLObjectType::VertexArray:
+			glDeleteVertexArrays(n, names.data());
+			break;
+		case GLObjectType::Shader:
+			for(auto name : names)
+				glDeleteShader(name);
+			break;
+		case GLObjectType::Program:
+			for(auto name : names)
+				glDeleteProgram(name);
+			break;
+		case GLObjectType::Sync:
+			for(auto itObj = it; itObj != itEnd; ++itObj)
+				glDeleteSync(itObj->sync);
+			break;
+		}
+		it = itEnd;
+	}
+	objects.clear();
+}
@@ -0,0 +1,67 @@
+// SPDX-FileCopyrightText: (c) 2020 Silverlan <opensource@pragma-engine.com>
+// SPDX-License-Identifier: MIT
+
+module;
+
+#include "opengl_api.hpp"
+
+export module pragma.prosper.opengl:deletion_queue;
+
+export import std;
+
+namespace prosper {
+	enum class GLObjectType : uint8_t {
+		Buffer = 0,
+		Texture,
+		Renderbuffer,
+		Framebuffer,
+		Sampler,
+		VertexArray,
+		Shader,
+		Program,
+		Sync,
+	};
+	// Lock-free multi-producer single-consumer queue of GL objects that are no longer referenced.
+	// Objects can be released from any thread, they're deleted on the GL thread once the GPU has
+	// finished the frame in which they were released (see GLContext::DrawFrame).
+	class GLDeletionQueue {
+	  public:
+		struct Object {
+			GLObjectType type = GLObjectType::Buffer;
+			GLuint name = 0;
+			GLsync sync = nullptr;
+		};
+		// There can only be one GL context, since the GL entry points are global
+		static GLDeletionQueue &Get();
+
+		~GLDeletionQueue();
+		void Enqueue(GLObjectType type, GLuint name);
+		void Enqueue(GLsync sync);
+
+		// Objects are only queued while a context exists, objects released after it has been destroyed are discarded
+		// (their names may already have been reused by a new context). Called when the context is created/destroyed.
+		void Activate();
+		void Deactivate();
+
+		// The following must only be called from the GL thread
+		// Assigns all objects released so far to the frame slot, they're deleted by the next Collect call for that slot
+		void Retire(uint32_t slotIndex);
+		void Collect(uint32_t slotIndex);
+		// Deletes all released objects immediately
+		void CollectAll();
+	  private:
+		struct Node {
+			Object object;
+			Node *next = nullptr;
+		};
+		GLDeletionQueue() = default;
+		void Push(const Object &object);
+		// Returns the released objects in the order they were released
+		std::vector<Object> TakeAll();
+		static void Delete(std::vector<Object> &objects);
+
+		std::atomic<Node *> m_head = nullptr;
+		std::atomic<bool> m_active = false;
+		std::vector<std::vector<Object>> m_retired;
+	};
+};
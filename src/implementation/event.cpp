@@ -1,18 +1,78 @@
 // SPDX-FileCopyrightText: (c) 2020 Silverlan <opensource@pragma-engine.com>
 // SPDX-License-Identifier: MIT
 
+module;
+
+#include "opengl_api.hpp"
+
 module pragma.prosper.opengl;
 
 import :event;
+import :deletion_queue;
 
 using namespace prosper;
 
 std::shared_ptr<IEvent> GLEvent::Create(IPrContext &context) { return std::shared_ptr<GLEvent> {new GLEvent {context}}; }
 
-GLEvent::~GLEvent() {}
+GLEvent::~GLEvent() { GLDeletionQueue::Get().Enqueue(m_sync.load()); }
 GLEvent::GLEvent(IPrContext &context) : IEvent {context} {}
 bool GLEvent::IsSet() const
 {
-	// TODO
-	return false;
+	if(m_set)
+		return true;
+	auto sync = m_sync.load();
+	if(sync == nullptr)
+		return false;
+	auto &context = static_cast<GLContext &>(GetContext());
+	if(context.RequiresGLThreadRoundTrip())
+		return context.RunOnGLThread([this]() { return IsSet(); });
+	GLint status;
+	glGetSynciv(sync, GL_SYNC_STATUS, 1, nullptr, &status);
+	if(status != GL_SIGNALED)
+		return false;
+	// The sync object is no longer needed once it has been signalled, unless the event has been reset in the meantime
+	if(m_sync.compare_exchange_strong(sync, nullptr) == false)
+		return false;
+	m_set = true;
+	GLDeletionQueue::Get().Enqueue(sync);
+	return true;
+}
+void GLEvent::Signal()
+{
+	auto &context = static_cast<GLContext &>(GetContext());
+	if(context.RequiresGLThreadRoundTrip())
+		return context.RunOnGLThread([this]() { Signal(); });
+	m_set = false;
+	GLDeletionQueue::Get().Enqueue(m_sync.exchange(glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0)));
+	// Make sure the signal point reaches the GPU, otherwise polling IsSet may never succeed
+	glFlush();
+	static_cast<GLContext &>(GetContext()).CheckResult();
+}
+void GLEvent::Reset()
+{
+	m_set = false;
+	GLDeletionQueue::Get().Enqueue(m_sync.exchange(nullptr));
+}
+Result GLEvent::Wait(uint64_t timeout) const
+{
+	if(m_set)
+		return Result::Success;
+	auto sync = m_sync.load();
+	if(sync == nullptr)
+		return Result::Timeout; // Never signalled
+	auto &context = static_cast<GLContext &>(GetContext());
+	if(context.RequiresGLThreadRoundTrip())
+		return context.RunOnGLThread([this, timeout]() { return Wait(timeout); });
+	auto res = glClientWaitSync(sync, GL_SYNC_FLUSH_COMMANDS_BIT, timeout);
+	switch(res) {
+	case GL_ALREADY_SIGNALED:
+	case GL_CONDITION_SATISFIED:
+		IsSet();
+		return Result::Success;
+	case GL_TIMEOUT_EXPIRED:
+		return Result::Timeout;
+	default:
+		static_cast<GLContext &>(GetContext()).CheckResult();
+		return Result::ErrorDeviceLost;
+	}
 }
@@ -8,12 +8,13 @@ module;
 module pragma.prosper.opengl;
 
 import :fence;
+import :deletion_queue;
 
 using namespace prosper;
 
 std::shared_ptr<IFence> GLFence::Create(IPrContext &context) { return std::shared_ptr<GLFence> {new GLFence {context}}; }
 
-GLFence::~GLFence() { Clear(); }
+GLFence::~GLFence() { GLDeletionQueue::Get().Enqueue(m_fence); }
 void GLFence::Clear() const
 {
 	if(m_fence == nullptr)
@@ -25,6 +26,9 @@ void GLFence::Clear() const
 GLFence::GLFence(IPrContext &context) : IFence {context} {}
 bool GLFence::IsSet() const
 {
+	auto &context = static_cast<GLContext &>(GetContext());
+	if(context.RequiresGLThreadRoundTrip())
+		return context.RunOnGLThread([this]() { return IsSet(); });
 	if(m_fence == nullptr)
 		return true;
 	GLint status;
@@ -33,12 +37,31 @@ bool GLFence::IsSet() const
 }
 bool GLFence::Reset() const
 {
+	auto &context = static_cast<GLContext &>(GetContext());
+	if(context.RequiresGLThreadRoundTrip())
+		return context.RunOnGLThread([this]() { return Reset(); });
 	Clear();
+	SetTimelineValue(0);
 	m_fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
 	return static_cast<GLContext &>(GetContext()).CheckResult();
 }
-void GLFence::Wait()
+Result GLFence::Wait(uint64_t timeout) const
 {
-	glClientWaitSync(m_fence, GL_SYNC_FLUSH_COMMANDS_BIT, std::numeric_limits<GLuint64>::max());
-	static_cast<GLContext &>(GetContext()).CheckResult();
+	if(m_fence == nullptr)
+		return Result::Success;
+	auto &context = static_cast<GLContext &>(GetContext());
+	if(context.RequiresGLThreadRoundTrip())
+		return context.RunOnGLThread([this, timeout]() { return Wait(timeout); });
+	// The flush ensures that the fence command reaches the GPU, otherwise the wait may never complete
+	auto res = glClientWaitSync(m_fence, GL_SYNC_FLUSH_COMMANDS_BIT, timeout);
+	switch(res) {
+	case GL_ALREADY_SIGNALED:
+	case GL_CONDITION_SATISFIED:
+		return Result::Success;
+	case GL_TIMEOUT_EXPIRED:
+		return Result::Timeout;
+	default:
+		static_cast<GLContext &>(GetContext()).CheckResult();
+		return Result::ErrorDeviceLost;
+	}
 }
@@ -8,6 +8,7 @@ module;
 module pragma.prosper.opengl;
 
 import :framebuffer;
+import :deletion_queue;
 
 using namespace prosper;
 
@@ -40,7 +41,9 @@ std::shared_ptr<IFramebuffer> GLFramebuffer::Create(IPrContext &context, const s
 			bufferTargets.push_back(GL_NONE);
 			continue; // Should be unreachable
 		}
-		if(baseLayer == 0)
+		if(img.IsRenderbuffer())
+			glNamedFramebufferRenderbuffer(framebuffer, attachment, GL_RENDERBUFFER, img.GetGLRenderbuffer());
+		else if(baseLayer == 0)
 			glNamedFramebufferTexture(framebuffer, attachment, texId, mipmapLevel);
 		else
 			glNamedFramebufferTextureLayer(framebuffer, attachment, texId, mipmapLevel, baseLayer);
@@ -57,11 +60,7 @@ GLFramebuffer::GLFramebuffer(IPrContext &context, const std::vector<std::shared_
 {
 }
 
-GLFramebuffer::~GLFramebuffer()
-{
-	if(m_framebuffer != 0)
-		glDeleteFramebuffers(1, &m_framebuffer);
-}
+GLFramebuffer::~GLFramebuffer() { GLDeletionQueue::Get().Enqueue(GLObjectType::Framebuffer, m_framebuffer); }
 void GLFramebuffer::UpateSize(uint32_t w, uint32_t h)
 {
 	m_width = w;
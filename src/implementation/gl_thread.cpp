@@ -0,0 +1,69 @@
+// SPDX-FileCopyrightText: (c) 2020 Silverlan <opensource@pragma-engine.com>
+// SPDX-License-Identifier: MIT
+
+module;
+
+#include "opengl_api.hpp"
+
+module pragma.prosper.opengl;
+
+import :gl_thread;
+
+using namespace prosper;
+
+GLThread::GLThread(GLFWwindow *window, uint32_t capacity) : m_window {window}
+{
+	m_ring.resize(std::bit_ceil(std::max(capacity, 2u)));
+	m_ringMask = m_ring.size() - 1;
+	m_thread = std::thread {[this]() { Run(); }};
+}
+GLThread::~GLThread()
+{
+	Push([this]() { m_running = false; });
+	m_thread.join();
+}
+void GLThread::Push(Task &&task)
+{
+	std::scoped_lock lock {m_producerMutex};
+	auto tail = m_tail.load(std::memory_order_relaxed);
+	for(;;) {
+		auto head = m_head.load(std::memory_order_acquire);
+		if(tail - head < m_ring.size())
+			break;
+		// The ring is full
+		m_head.wait(head, std::memory_order_acquire);
+	}
+	m_ring[tail & m_ringMask] = std::move(task);
+	m_tail.store(tail + 1, std::memory_order_release);
+	m_tail.notify_one();
+}
+void GLThread::Call(const Task &task)
+{
+	if(IsCurrentThread()) {
+		task();
+		return;
+	}
+	std::atomic<bool> done = false;
+	Push([&task, &done]() {
+		task();
+		done.store(true, std::memory_order_release);
+		done.notify_one();
+	});
+	done.wait(false, std::memory_order_acquire);
+}
+void GLThread::Run()
+{
+	while(m_running) {
+		auto head = m_head.load(std::memory_order_relaxed);
+		auto tail = m_tail.load(std::memory_order_acquire);
+		if(head == tail) {
+			m_tail.wait(tail, std::memory_order_acquire);
+			continue;
+		}
+		auto task = std::move(m_ring[head & m_ringMask]);
+		m_ring[head & m_ringMask] = nullptr;
+		m_head.store(head + 1, std::memory_order_release);
+		m_head.notify_one();
+		task();
+	}
+}
@@ -0,0 +1,42 @@
+// SPDX-FileCopyrightText: (c) 2020 Silverlan <opensource@pragma-engine.com>
+// SPDX-License-Identifier: MIT
+
+module;
+
+#include "opengl_api.hpp"
+
+export module pragma.prosper.opengl:gl_thread;
+
+export import std;
+
+namespace prosper {
+	// Thread that executes tasks in submission order, see GLContext::SetThreadedSubmissionEnabled.
+	// Tasks are passed through a fixed-size lock-free single-producer single-consumer ring, if the ring is full
+	// the producer waits for the thread to catch up. Submissions from multiple threads are serialized by a mutex,
+	// which is uncontended as long as only the main thread submits.
+	class GLThread {
+	  public:
+		using Task = std::function<void()>;
+		GLThread(GLFWwindow *window, uint32_t capacity = 1'024);
+		// Waits for all submitted tasks to complete
+		~GLThread();
+		GLFWwindow *GetWindow() const { return m_window; }
+		bool IsCurrentThread() const { return std::this_thread::get_id() == m_thread.get_id(); }
+
+		void Push(Task &&task);
+		// Executes the task on the thread and waits for it to complete
+		void Call(const Task &task);
+	  private:
+		void Run();
+		GLFWwindow *m_window = nullptr;
+		std::vector<Task> m_ring;
+		uint64_t m_ringMask = 0;
+		// Index of the next task to execute, only written by the thread
+		alignas(64) std::atomic<uint64_t> m_head = 0;
+		// Index of the next free slot, only written by the producer
+		alignas(64) std::atomic<uint64_t> m_tail = 0;
+		std::mutex m_producerMutex;
+		bool m_running = true;
+		std::thread m_thread;
+	};
+};
@@ -8,6 +8,7 @@ module;
 module pragma.prosper.opengl;
 
 import :image.image;
+import :deletion_queue;
 
 using namespace prosper;
 
@@ -49,6 +50,21 @@ static void test_cubemap()
 std::shared_ptr<IImage> GLImage::Create(IPrContext &context, const prosper::util::ImageCreateInfo &createInfo, const std::function<const uint8_t *(uint32_t layer, uint32_t mipmap, uint32_t &dataSize, uint32_t &rowSize)> &getImageData)
 {
 	auto isCubemap = pragma::math::is_flag_set(createInfo.flags, util::ImageCreateInfo::Flags::Cubemap);
+	GLenum pixelFormat;
+	auto format = prosper::util::to_opengl_image_format(createInfo.format, &pixelFormat);
+	auto numSamples = GetSampleCount(createInfo);
+	if(ShouldUseRenderbuffer(createInfo)) {
+		GLuint renderbuffer;
+		glCreateRenderbuffers(1, &renderbuffer);
+		glNamedRenderbufferStorageMultisample(renderbuffer, numSamples, format, createInfo.width, createInfo.height);
+		auto img = std::shared_ptr<GLImage> {new GLImage {context, createInfo, 0, pixelFormat}};
+		img->m_renderbuffer = renderbuffer;
+		if(static_cast<GLContext &>(context).CheckResult() == false)
+			return nullptr;
+		img->InitializeSubresourceLayouts();
+		return img;
+	}
+
 	auto type = GetImageType(createInfo);
 	GLuint tex;
 	glCreateTextures(type, 1, &tex);
@@ -58,9 +74,14 @@ std::shared_ptr<IImage> GLImage::Create(IPrContext &context, const prosper::util
 	uint32_t mipLevels = 1;
 	if(pragma::math::is_flag_set(createInfo.flags, prosper::util::ImageCreateInfo::Flags::FullMipmapChain))
 		mipLevels = prosper::util::calculate_mipmap_count(createInfo.width, createInfo.height);
-	GLenum pixelFormat;
-	auto format = prosper::util::to_opengl_image_format(createInfo.format, &pixelFormat);
-	if(IsLayered(createInfo) == false)
+	if(numSamples > 1) {
+		// Multisampled textures can't have mipmaps
+		if(IsLayered(createInfo) == false)
+			glTextureStorage2DMultisample(tex, numSamples, format, createInfo.width, createInfo.height, GL_TRUE);
+		else
+			glTextureStorage3DMultisample(tex, numSamples, format, createInfo.width, createInfo.height, createInfo.layers, GL_TRUE);
+	}
+	else if(IsLayered(createInfo) == false)
 		glTextureStorage2D(tex, mipLevels, format, createInfo.width, createInfo.height);
 	else
 		glTextureStorage3D(tex, mipLevels, format, createInfo.width, createInfo.height, createInfo.layers);
@@ -91,6 +112,8 @@ std::shared_ptr<IImage> GLImage::Create(IPrContext &context, const prosper::util
 uint64_t GLImage::GetLayerSize(uint32_t w, uint32_t h) const { return w * h * (prosper::util::is_compressed_format(GetFormat()) ? prosper::util::get_block_size(GetFormat()) : prosper::util::get_byte_size(GetFormat())); }
 bool GLImage::WriteImageData(uint32_t x, uint32_t y, uint32_t w, uint32_t h, uint32_t layerIndex, uint32_t mipLevel, uint64_t size, const uint8_t *data)
 {
+	if(IsMultisampled())
+		return false; // Multisampled images can only be written to via rendering
 	auto type = GetImageType(layerIndex);
 	auto is3DType = (type == GL_TEXTURE_2D_ARRAY || type == GL_TEXTURE_3D);
 	auto isCubemap = IsCubemap();
@@ -114,6 +137,14 @@ bool GLImage::WriteImageData(uint32_t x, uint32_t y, uint32_t w, uint32_t h, uin
 	return static_cast<GLContext &>(GetContext()).CheckResult();
 }
 bool GLImage::IsLayered() const { return IsLayered(GetCreateInfo()); }
+uint32_t GLImage::GetSampleCount(const prosper::util::ImageCreateInfo &createInfo) { return pragma::math::max(static_cast<uint32_t>(createInfo.samples), static_cast<uint32_t>(1)); }
+bool GLImage::ShouldUseRenderbuffer(const prosper::util::ImageCreateInfo &createInfo)
+{
+	if(GetSampleCount(createInfo) <= 1 || createInfo.layers > 1)
+		return false;
+	return (createInfo.usage & (ImageUsageFlags::SampledBit | ImageUsageFlags::StorageBit)) == ImageUsageFlags {};
+}
+bool GLImage::IsMultisampled() const { return GetSampleCount(GetCreateInfo()) > 1; }
 bool GLImage::IsLayered(const prosper::util::ImageCreateInfo &createInfo) { return (createInfo.layers > 1 && pragma::math::is_flag_set(createInfo.flags, util::ImageCreateInfo::Flags::Cubemap) == false); }
 GLenum GLImage::GetImageType(const prosper::util::ImageCreateInfo &createInfo)
 {
@@ -126,7 +157,10 @@ GLenum GLImage::GetImageType(const prosper::util::ImageCreateInfo &createInfo)
 			type = IsLayered(createInfo) ? GL_TEXTURE_1D_ARRAY : GL_TEXTURE_1D;
 			break;
 		case prosper::ImageType::e2D:
-			type = IsLayered(createInfo) ? GL_TEXTURE_2D_ARRAY : GL_TEXTURE_2D;
+			if(GetSampleCount(createInfo) > 1)
+				type = IsLayered(createInfo) ? GL_TEXTURE_2D_MULTISAMPLE_ARRAY : GL_TEXTURE_2D_MULTISAMPLE;
+			else
+				type = IsLayered(createInfo) ? GL_TEXTURE_2D_ARRAY : GL_TEXTURE_2D;
 			break;
 		case prosper::ImageType::e3D:
 			type = GL_TEXTURE_3D;
@@ -141,8 +175,11 @@ GLenum GLImage::GetImageType(const prosper::util::ImageCreateInfo &createInfo)
 GLImage::GLImage(IPrContext &context, const prosper::util::ImageCreateInfo &createInfo, GLuint texture, GLenum pixelFormat) : IImage {context, createInfo}, m_image {texture}, m_pixelDataFormat {pixelFormat} {}
 GLImage::~GLImage()
 {
-	if(m_image != 0)
-		glDeleteTextures(1, &m_image);
+	auto &deletionQueue = GLDeletionQueue::Get();
+	for(auto &view : m_textureViews)
+		deletionQueue.Enqueue(GLObjectType::Texture, view.texture);
+	deletionQueue.Enqueue(GLObjectType::Texture, m_image);
+	deletionQueue.Enqueue(GLObjectType::Renderbuffer, m_renderbuffer);
 }
 GLenum GLImage::GetBufferBit() const { return prosper::util::is_depth_format(GetFormat()) ? GL_DEPTH_BUFFER_BIT : GL_COLOR_BUFFER_BIT; }
 GLenum GLImage::GetImageType() const { return GetImageType(GetCreateInfo()); }
@@ -169,7 +206,7 @@ GLenum GLImage::GetImageType(uint32_t layerIndex) const
 }
 std::shared_ptr<GLFramebuffer> GLImage::GetOrCreateFramebuffer(uint32_t baseLayerId, uint32_t layerCount, uint32_t baseMipmap, uint32_t mipmapCount)
 {
-	if(m_image == 0)
+	if(IsSwapchainImage())
 		return std::static_pointer_cast<GLFramebuffer>(static_cast<GLContext &>(GetContext()).GetSwapchainFramebuffer(0)->shared_from_this());
 	auto it = std::find_if(m_framebuffers.begin(), m_framebuffers.end(), [baseLayerId, layerCount, baseMipmap, mipmapCount](const std::shared_ptr<GLFramebuffer> &framebuffer) {
 		if(layerCount != framebuffer->GetLayerCount() || framebuffer->GetAttachmentCount() != 1)
@@ -184,15 +221,35 @@ std::shared_ptr<GLFramebuffer> GLImage::GetOrCreateFramebuffer(uint32_t baseLaye
 	imgViewCreateInfo.baseLayer = baseLayerId;
 	imgViewCreateInfo.baseMipmap = baseMipmap;
 	imgViewCreateInfo.mipmapLevels = mipmapCount;
-	// OpenGL doesn't have image views, so for the OpenGL implementation
-	// they just serve as a meta information struct. They also don't use up
-	// any OpenGL resources, so we can just allocate however many we want/need.
+	// Image views only allocate an OpenGL texture view once they're bound to a shader,
+	// so they're cheap to create for framebuffer attachments.
 	auto imgView = GetContext().CreateImageView(imgViewCreateInfo, *this);
 	auto framebuffer = GetContext().CreateFramebuffer(GetWidth(), GetHeight(), layerCount, {imgView.get()});
 	static_cast<GLContext &>(GetContext()).CheckFramebufferStatus(*framebuffer);
 	m_framebuffers.push_back(std::static_pointer_cast<GLFramebuffer>(framebuffer));
 	return m_framebuffers.back();
 }
+GLuint GLImage::GetOrCreateTextureView(GLenum target, GLenum internalFormat, uint32_t baseLayerId, uint32_t layerCount, uint32_t baseMipmap, uint32_t mipmapCount)
+{
+	if(m_image == 0)
+		return 0;
+	auto it = std::find_if(m_textureViews.begin(), m_textureViews.end(), [target, internalFormat, baseLayerId, layerCount, baseMipmap, mipmapCount](const TextureView &view) {
+		return view.target == target && view.internalFormat == internalFormat && view.baseLayer == baseLayerId && view.layerCount == layerCount && view.baseMipmap == baseMipmap && view.mipmapCount == mipmapCount;
+	});
+	if(it != m_textureViews.end())
+		return it->texture;
+
+	// Texture views require a texture name that has never been bound, so we can't use glCreateTextures here
+	GLuint texture;
+	glGenTextures(1, &texture);
+	glTextureView(texture, target, m_image, internalFormat, baseMipmap, mipmapCount, baseLayerId, layerCount);
+	if(static_cast<GLContext &>(GetContext()).CheckResult() == false) {
+		glDeleteTextures(1, &texture);
+		return 0;
+	}
+	m_textureViews.push_back({target, internalFormat, baseLayerId, layerCount, baseMipmap, mipmapCount, texture});
+	return texture;
+}
 void GLImage::InitializeSubresourceLayouts()
 {
 	auto numLayers = GetLayerCount();
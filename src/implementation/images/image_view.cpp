@@ -1,6 +1,10 @@
 // SPDX-FileCopyrightText: (c) 2020 Silverlan <opensource@pragma-engine.com>
 // SPDX-License-Identifier: MIT
 
+module;
+
+#include "opengl_api.hpp"
+
 module pragma.prosper.opengl;
 
 import :image.view;
@@ -12,3 +16,62 @@ std::shared_ptr<IImageView> GLImageView::Create(IPrContext &context, IImage &img
 GLImageView::~GLImageView() {}
 
 GLImageView::GLImageView(IPrContext &context, IImage &img, const prosper::util::ImageViewCreateInfo &createInfo, ImageViewType type, ImageAspectFlags aspectFlags) : IImageView {context, img, createInfo, type, aspectFlags} {}
+
+static void get_view_range(const IImageView &imgView, uint32_t &outNumLayers, uint32_t &outNumMipmaps)
+{
+	// Layer and mipmap counts may exceed the image range (e.g. 'remaining layers'), so we have to clamp them
+	auto &img = imgView.GetImage();
+	auto numImageLayers = img.GetLayerCount();
+	auto numImageMipmaps = img.GetMipmapCount();
+	outNumLayers = pragma::math::min(imgView.GetLayerCount(), numImageLayers - pragma::math::min(imgView.GetBaseLayer(), numImageLayers));
+	outNumMipmaps = pragma::math::min(imgView.GetMipmapCount(), numImageMipmaps - pragma::math::min(imgView.GetBaseMipmapLevel(), numImageMipmaps));
+}
+
+static GLenum get_view_target(const IImageView &imgView)
+{
+	auto target = util::to_opengl_enum(imgView.GetType());
+	if(static_cast<const GLImage &>(imgView.GetImage()).IsMultisampled() == false)
+		return target;
+	switch(target) {
+	case GL_TEXTURE_2D:
+		return GL_TEXTURE_2D_MULTISAMPLE;
+	case GL_TEXTURE_2D_ARRAY:
+		return GL_TEXTURE_2D_MULTISAMPLE_ARRAY;
+	}
+	return target;
+}
+
+bool GLImageView::IsTextureView() const
+{
+	auto &img = static_cast<GLImage &>(GetImage());
+	if(img.GetGLImage() == 0)
+		return false; // Swapchain image or renderbuffer
+	uint32_t numLayers, numMipmaps;
+	get_view_range(*this, numLayers, numMipmaps);
+	if(GetBaseLayer() != 0 || GetBaseMipmapLevel() != 0 || numLayers != img.GetLayerCount() || numMipmaps != img.GetMipmapCount())
+		return true;
+	if(util::to_opengl_image_format(GetFormat()) != util::to_opengl_image_format(img.GetFormat()))
+		return true;
+	return get_view_target(*this) != img.GetImageType();
+}
+
+GLuint GLImageView::GetGLTexture() const
+{
+	if(m_texture.has_value())
+		return *m_texture;
+	auto &img = static_cast<GLImage &>(GetImage());
+	if(IsTextureView() == false) {
+		m_texture = img.GetGLImage();
+		return *m_texture;
+	}
+	uint32_t numLayers, numMipmaps;
+	get_view_range(*this, numLayers, numMipmaps);
+	auto texture = img.GetOrCreateTextureView(get_view_target(*this), util::to_opengl_image_format(GetFormat()), GetBaseLayer(), numLayers, GetBaseMipmapLevel(), numMipmaps);
+	if(texture == 0) {
+		// Incompatible view parameters; Fall back to the full image
+		GetContext().ValidationCallback(DebugMessageSeverityFlags::WarningBit, "Failed to create texture view for image '" + img.GetDebugName() + "'! Falling back to full image...");
+		texture = img.GetGLImage();
+	}
+	m_texture = texture;
+	return texture;
+}
@@ -8,13 +8,14 @@ module;
 module pragma.prosper.opengl;
 
 import :image.sampler;
+import :deletion_queue;
 
 using namespace prosper;
 std::shared_ptr<ISampler> GLSampler::Create(IPrContext &context, const prosper::util::SamplerCreateInfo &samplerCreateInfo, GLuint sampler) { return std::shared_ptr<GLSampler> {new GLSampler {context, samplerCreateInfo, sampler}}; }
 
 GLSampler::GLSampler(IPrContext &context, const prosper::util::SamplerCreateInfo &samplerCreateInfo, GLuint sampler) : ISampler {context, samplerCreateInfo}, m_sampler {sampler} { Update(); }
 
-GLSampler::~GLSampler() { glDeleteSamplers(1, &m_sampler); }
+GLSampler::~GLSampler() { GLDeletionQueue::Get().Enqueue(GLObjectType::Sampler, m_sampler); }
 
 GLuint GLSampler::GetGLSampler() const { return m_sampler; }
 
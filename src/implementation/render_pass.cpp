@@ -1,14 +1,256 @@
 // SPDX-FileCopyrightText: (c) 2020 Silverlan <opensource@pragma-engine.com>
 // SPDX-License-Identifier: MIT
 
+module;
+
+#include "opengl_api.hpp"
+
 module pragma.prosper.opengl;
 
 import :render_pass;
 
 using namespace prosper;
 
+namespace {
+	// Region of a single layer of a framebuffer attachment, which is cleared or invalidated through the texture directly
+	struct LayerRegion {
+		GLuint texture = 0;
+		GLint mipmap = 0;
+		GLint yOffset = 0;
+		GLint zOffset = 0;
+		GLsizei width = 0;
+		GLsizei height = 0;
+	};
+	std::optional<LayerRegion> get_layer_region(GLFramebuffer &framebuffer, uint32_t attId, uint32_t layerId)
+	{
+		auto *imgView = framebuffer.GetAttachment(attId);
+		if(imgView == nullptr)
+			return {};
+		auto &img = static_cast<GLImage &>(imgView->GetImage());
+		if(img.IsRenderbuffer() || img.IsSwapchainImage() || layerId >= img.GetLayerCount())
+			return {};
+		LayerRegion region {};
+		region.texture = img.GetGLImage();
+		region.mipmap = imgView->GetBaseMipmapLevel();
+		region.width = img.GetWidth(region.mipmap);
+		region.height = img.GetHeight(region.mipmap);
+		switch(img.GetImageType()) {
+		case GL_TEXTURE_1D_ARRAY:
+			// Layers of 1D array textures are addressed by the y-coordinate
+			region.yOffset = layerId;
+			region.height = 1;
+			break;
+		case GL_TEXTURE_1D:
+		case GL_TEXTURE_2D:
+		case GL_TEXTURE_2D_MULTISAMPLE:
+		case GL_TEXTURE_3D:
+			break;
+		default:
+			region.zOffset = layerId;
+			break;
+		}
+		return region;
+	}
+};
+
 std::shared_ptr<IRenderPass> GLRenderPass::Create(IPrContext &context, const prosper::util::RenderPassCreateInfo &createInfo) { return std::shared_ptr<GLRenderPass> {new GLRenderPass {context, createInfo}}; }
 
 GLRenderPass::~GLRenderPass() {}
 
-GLRenderPass::GLRenderPass(IPrContext &context, const prosper::util::RenderPassCreateInfo &createInfo) : IRenderPass {context, createInfo} {}
+GLRenderPass::GLRenderPass(IPrContext &context, const prosper::util::RenderPassCreateInfo &createInfo) : IRenderPass {context, createInfo}
+{
+	// Determine the clear calls and invalidations for all attachments once, so that beginning
+	// and ending the render pass doesn't have to inspect the attachment formats every time.
+	for(auto attId = decltype(createInfo.attachments.size()) {0u}; attId < createInfo.attachments.size(); ++attId) {
+		auto &attInfo = createInfo.attachments.at(attId);
+		auto isDepth = prosper::util::is_depth_format(attInfo.format);
+		AttachmentInvalidation invalidation {};
+		invalidation.attachmentIndex = attId;
+		// See GLFramebuffer::Create
+		invalidation.attachment = isDepth ? GL_DEPTH_ATTACHMENT : (GL_COLOR_ATTACHMENT0 + attId);
+		invalidation.defaultFramebufferAttachment = isDepth ? GL_DEPTH : GL_COLOR;
+		if(attInfo.loadOp == prosper::AttachmentLoadOp::DontCare)
+			m_beginInvalidations.push_back(invalidation);
+		if(attInfo.storeOp == prosper::AttachmentStoreOp::DontCare)
+			m_endInvalidations.push_back(invalidation);
+
+		if(attInfo.loadOp != prosper::AttachmentLoadOp::Clear)
+			continue;
+		AttachmentClear clear {};
+		clear.attachmentIndex = attId;
+		if(isDepth) {
+			if(prosper::util::has_stencil_component(attInfo.format)) {
+				clear.type = ClearType::DepthStencil;
+				m_clearsStencil = true;
+			}
+			else
+				clear.type = ClearType::Depth;
+			m_clearsDepth = true;
+		}
+		else {
+			GLenum pixelDataFormat;
+			prosper::util::to_opengl_image_format(attInfo.format, &pixelDataFormat);
+			if(prosper::util::is_integer_pixel_data_format(pixelDataFormat)) {
+				GLboolean normalized;
+				auto type = prosper::util::to_opengl_image_format_type(attInfo.format, normalized);
+				clear.type = (type == GL_BYTE || type == GL_SHORT || type == GL_INT) ? ClearType::ColorInt : ClearType::ColorUInt;
+			}
+			else
+				clear.type = ClearType::ColorFloat;
+			m_clearsColor = true;
+		}
+		m_clears.push_back(clear);
+	}
+}
+
+void GLRenderPass::Invalidate(GLFramebuffer &framebuffer, const std::vector<AttachmentInvalidation> &invalidations, bool skipMultisampled)
+{
+	if(invalidations.empty())
+		return;
+	auto fb = framebuffer.GetGLFramebuffer();
+	std::array<GLenum, 16> attachments;
+	uint32_t numAttachments = 0;
+	for(auto &invalidation : invalidations) {
+		if(numAttachments == attachments.size())
+			break;
+		if(skipMultisampled) {
+			auto *imgView = framebuffer.GetAttachment(invalidation.attachmentIndex);
+			if(imgView && static_cast<GLImage &>(imgView->GetImage()).IsMultisampled())
+				continue;
+		}
+		attachments[numAttachments++] = (fb == 0) ? invalidation.defaultFramebufferAttachment : invalidation.attachment;
+	}
+	if(numAttachments > 0)
+		glInvalidateNamedFramebufferData(fb, numAttachments, attachments.data());
+}
+
+void GLRenderPass::InvalidateLayer(GLFramebuffer &framebuffer, const std::vector<AttachmentInvalidation> &invalidations, uint32_t layerId, bool skipMultisampled)
+{
+	for(auto &invalidation : invalidations) {
+		if(skipMultisampled) {
+			auto *imgView = framebuffer.GetAttachment(invalidation.attachmentIndex);
+			if(imgView && static_cast<GLImage &>(imgView->GetImage()).IsMultisampled())
+				continue;
+		}
+		auto region = get_layer_region(framebuffer, invalidation.attachmentIndex, layerId);
+		if(region.has_value() == false)
+			continue;
+		glInvalidateTexSubImage(region->texture, region->mipmap, 0, region->yOffset, region->zOffset, region->width, region->height, 1);
+	}
+}
+
+void GLRenderPass::RecordLoadOps(GLFramebuffer &framebuffer, const std::vector<prosper::ClearValue> &clearValues) const
+{
+	Invalidate(framebuffer, m_beginInvalidations, false);
+	if(m_clears.empty())
+		return;
+
+	// glClearNamedFramebuffer* is affected by the scissor test and the write masks
+	glDisable(GL_SCISSOR_TEST);
+	if(m_clearsColor)
+		glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+	GLboolean depthWritesEnabled;
+	if(m_clearsDepth) {
+		glGetBooleanv(GL_DEPTH_WRITEMASK, &depthWritesEnabled);
+		glDepthMask(GL_TRUE);
+	}
+	GLint stencilWriteMask;
+	if(m_clearsStencil) {
+		glGetIntegerv(GL_STENCIL_WRITEMASK, &stencilWriteMask);
+		glStencilMask(std::numeric_limits<GLuint>::max());
+	}
+
+	auto fb = framebuffer.GetGLFramebuffer();
+	for(auto &clear : m_clears) {
+		if(clear.attachmentIndex >= clearValues.size())
+			break;
+		auto &clearVal = clearValues.at(clear.attachmentIndex);
+		// The draw buffer index matches the attachment index (see GLFramebuffer::Create)
+		GLint drawBuffer = (fb == 0) ? 0 : clear.attachmentIndex;
+		switch(clear.type) {
+		case ClearType::ColorFloat:
+			glClearNamedFramebufferfv(fb, GL_COLOR, drawBuffer, clearVal.color.float32);
+			break;
+		case ClearType::ColorInt:
+			glClearNamedFramebufferiv(fb, GL_COLOR, drawBuffer, clearVal.color.int32);
+			break;
+		case ClearType::ColorUInt:
+			glClearNamedFramebufferuiv(fb, GL_COLOR, drawBuffer, clearVal.color.uint32);
+			break;
+		case ClearType::Depth:
+			glClearNamedFramebufferfv(fb, GL_DEPTH, 0, &clearVal.depthStencil.depth);
+			break;
+		case ClearType::DepthStencil:
+			glClearNamedFramebufferfi(fb, GL_DEPTH_STENCIL, 0, clearVal.depthStencil.depth, clearVal.depthStencil.stencil);
+			break;
+		}
+	}
+
+	if(m_clearsDepth)
+		glDepthMask(depthWritesEnabled);
+	if(m_clearsStencil)
+		glStencilMask(stencilWriteMask);
+}
+
+void GLRenderPass::RecordStoreOps(GLFramebuffer &framebuffer) const
+{
+	// Multisampled attachments still have to be resolved after the render pass, their store op is applied after the resolve instead
+	Invalidate(framebuffer, m_endInvalidations, true);
+}
+
+void GLRenderPass::RecordLoadOps(GLFramebuffer &framebuffer, const std::vector<prosper::ClearValue> &clearValues, uint32_t layerId) const
+{
+	InvalidateLayer(framebuffer, m_beginInvalidations, layerId, false);
+	// Unlike glClearNamedFramebuffer*, glClearTexSubImage isn't affected by the scissor test and the write masks
+	for(auto &clear : m_clears) {
+		if(clear.attachmentIndex >= clearValues.size())
+			break;
+		auto region = get_layer_region(framebuffer, clear.attachmentIndex, layerId);
+		if(region.has_value() == false)
+			continue;
+		auto &clearVal = clearValues.at(clear.attachmentIndex);
+		GLenum dataFormat;
+		GLenum dataType;
+		const void *data;
+		struct {
+			float depth;
+			uint32_t stencil;
+		} depthStencil;
+		switch(clear.type) {
+		case ClearType::ColorFloat:
+			dataFormat = GL_RGBA;
+			dataType = GL_FLOAT;
+			data = clearVal.color.float32;
+			break;
+		case ClearType::ColorInt:
+			dataFormat = GL_RGBA_INTEGER;
+			dataType = GL_INT;
+			data = clearVal.color.int32;
+			break;
+		case ClearType::ColorUInt:
+			dataFormat = GL_RGBA_INTEGER;
+			dataType = GL_UNSIGNED_INT;
+			data = clearVal.color.uint32;
+			break;
+		case ClearType::Depth:
+			dataFormat = GL_DEPTH_COMPONENT;
+			dataType = GL_FLOAT;
+			data = &clearVal.depthStencil.depth;
+			break;
+		case ClearType::DepthStencil:
+			depthStencil.depth = clearVal.depthStencil.depth;
+			depthStencil.stencil = clearVal.depthStencil.stencil;
+			dataFormat = GL_DEPTH_STENCIL;
+			dataType = GL_FLOAT_32_UNSIGNED_INT_24_8_REV;
+			data = &depthStencil;
+			break;
+		}
+		glClearTexSubImage(region->texture, region->mipmap, 0, region->yOffset, region->zOffset, region->width, region->height, 1, dataFormat, dataType, data);
+	}
+}
+
+void GLRenderPass::RecordStoreOps(GLFramebuffer &framebuffer, uint32_t layerId) const
+{
+	// Only the rendered layer may be discarded, the other layers may contain the results of previous render passes
+	InvalidateLayer(framebuffer, m_endInvalidations, layerId, true);
+}
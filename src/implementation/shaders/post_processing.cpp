@@ -5,7 +5,169 @@ module pragma.prosper.opengl;
 
 import :shader.post_processing;
 
-bool prosper::util::convert_glsl_set_bindings_to_opengl_binding_points(std::vector<std::string> &inOutGlslCodePerStage, std::string &outErrMsg)
+namespace {
+	// Replaces the range with the binding point
+	struct GlslEdit {
+		size_t start;
+		size_t end;
+		uint32_t bindingPoint;
+	};
+	// Specialization constants are not supported by OpenGL, so the layout qualifiers have to be removed.
+	// The code is compacted in-place in a single pass. The removed ranges (offset in the original code and length) are
+	// optionally returned.
+	void strip_constant_id_layouts(std::string &inOutGlslCode, std::vector<std::pair<size_t, size_t>> *optOutRemovedRanges = nullptr)
+	{
+		constexpr std::string_view constantIdLayout = "layout(constant_id";
+		auto pos = inOutGlslCode.find(constantIdLayout);
+		if(pos == std::string::npos)
+			return;
+		auto writePos = pos;
+		while(pos != std::string::npos) {
+			auto posEnd = inOutGlslCode.find(')', pos);
+			if(posEnd == std::string::npos)
+				break;
+			auto readPos = posEnd + 1;
+			if(optOutRemovedRanges)
+				optOutRemovedRanges->push_back({pos, readPos - pos});
+			pos = inOutGlslCode.find(constantIdLayout, readPos);
+			auto len = ((pos != std::string::npos) ? pos : inOutGlslCode.size()) - readPos;
+			std::memmove(inOutGlslCode.data() + writePos, inOutGlslCode.data() + readPos, len);
+			writePos += len;
+		}
+		if(pos != std::string::npos) {
+			// Unterminated layout qualifier, keep the remaining code as-is
+			auto len = inOutGlslCode.size() - pos;
+			std::memmove(inOutGlslCode.data() + writePos, inOutGlslCode.data() + pos, len);
+			writePos += len;
+		}
+		inOutGlslCode.resize(writePos);
+	}
+	void map_to_original_positions(std::vector<prosper::IPrContext::ShaderMacroLocation> &inOutMacroLocations, const std::vector<std::pair<size_t, size_t>> &removedRanges)
+	{
+		if(removedRanges.empty())
+			return;
+		std::sort(inOutMacroLocations.begin(), inOutMacroLocations.end(), [](const auto &a, const auto &b) { return a.macroStart < b.macroStart; });
+		size_t rangeIdx = 0;
+		size_t offset = 0;
+		for(auto &loc : inOutMacroLocations) {
+			// Position of the removed range in the stripped code is its original position minus everything removed before it
+			while(rangeIdx < removedRanges.size() && removedRanges[rangeIdx].first - offset <= loc.macroStart)
+				offset += removedRanges[rangeIdx++].second;
+			loc.macroStart += offset;
+			loc.macroEnd += offset;
+		}
+	}
+	void apply_edits(std::string &inOutGlslCode, std::vector<GlslEdit> &edits)
+	{
+		if(edits.empty())
+			return;
+		std::sort(edits.begin(), edits.end(), [](const GlslEdit &a, const GlslEdit &b) { return a.start < b.start; });
+		std::string output;
+		output.reserve(inOutGlslCode.size() + edits.size() * 16);
+		size_t pos = 0;
+		std::array<char, 16> bindingPointBuf;
+		for(auto &edit : edits) {
+			if(edit.start < pos)
+				continue; // Overlapping edit, should be unreachable
+			output.append(inOutGlslCode, pos, edit.start - pos);
+			output += "binding = ";
+			auto [end, ec] = std::to_chars(bindingPointBuf.data(), bindingPointBuf.data() + bindingPointBuf.size(), edit.bindingPoint);
+			output.append(bindingPointBuf.data(), end);
+			pos = edit.end;
+		}
+		output.append(inOutGlslCode, pos, std::string::npos);
+		inOutGlslCode = std::move(output);
+	}
+	std::string_view trim_left(std::string_view str)
+	{
+		auto pos = str.find_first_not_of(" \t\r\n");
+		return (pos != std::string_view::npos) ? str.substr(pos) : std::string_view {};
+	}
+	std::optional<uint32_t> parse_constant_id(std::string_view layout)
+	{
+		// constant_id = <id>
+		auto pos = layout.find('=');
+		if(pos == std::string_view::npos)
+			return {};
+		auto idStr = trim_left(layout.substr(pos + 1));
+		uint32_t id;
+		auto [ptr, ec] = std::from_chars(idStr.data(), idStr.data() + idStr.size(), id);
+		if(ec != std::errc {})
+			return {};
+		return id;
+	}
+	std::string_view get_declaration_type(std::string_view declaration)
+	{
+		// const [precision] <type> <name>
+		std::array<std::string_view, 2> lastTokens {};
+		for(;;) {
+			declaration = trim_left(declaration);
+			if(declaration.empty())
+				break;
+			auto end = std::min(declaration.find_first_of(" \t\r\n"), declaration.size());
+			lastTokens[0] = lastTokens[1];
+			lastTokens[1] = declaration.substr(0, end);
+			declaration.remove_prefix(end);
+		}
+		return lastTokens[0];
+	}
+	std::optional<std::string> to_glsl_literal(std::string_view type, uint32_t value)
+	{
+		if(type == "bool")
+			return value ? "true" : "false";
+		if(type == "int")
+			return std::to_string(std::bit_cast<int32_t>(value));
+		if(type == "uint")
+			return std::to_string(value) + 'u';
+		if(type == "float") {
+			auto f = std::bit_cast<float>(value);
+			if(std::isfinite(f) == false)
+				return {};
+			auto str = std::format("{:.9g}", f);
+			if(str.find_first_of(".e") == std::string::npos)
+				str += ".0";
+			return str;
+		}
+		return {};
+	}
+};
+
+std::string prosper::util::specialize_glsl(const std::string &glslCode, std::span<const uint32_t> constantIds, std::span<const uint32_t> constantValues)
+{
+	constexpr std::string_view constantIdLayout = "layout(constant_id";
+	std::string output;
+	output.reserve(glslCode.size());
+	size_t readPos = 0;
+	auto pos = glslCode.find(constantIdLayout);
+	while(pos != std::string::npos) {
+		auto posEnd = glslCode.find(')', pos);
+		if(posEnd == std::string::npos)
+			break;
+		output.append(glslCode, readPos, pos - readPos);
+		readPos = posEnd + 1;
+
+		// layout(constant_id = <id>) const <type> <name> = <default value>;
+		auto constantId = parse_constant_id(std::string_view {glslCode}.substr(pos + constantIdLayout.size(), posEnd - pos - constantIdLayout.size()));
+		auto posValue = glslCode.find('=', readPos);
+		auto posValueEnd = glslCode.find(';', readPos);
+		auto it = constantId ? std::find(constantIds.begin(), constantIds.end(), *constantId) : constantIds.end();
+		if(it != constantIds.end() && posValue < posValueEnd && posValueEnd != std::string::npos) {
+			auto type = get_declaration_type(std::string_view {glslCode}.substr(readPos, posValue - readPos));
+			auto literal = to_glsl_literal(type, constantValues[it - constantIds.begin()]);
+			if(literal) {
+				output.append(glslCode, readPos, posValue + 1 - readPos);
+				output += ' ';
+				output += *literal;
+				readPos = posValueEnd;
+			}
+		}
+		pos = glslCode.find(constantIdLayout, readPos);
+	}
+	output.append(glslCode, readPos, std::string::npos);
+	return output;
+}
+
+bool prosper::util::rewrite_glsl_for_opengl(std::vector<std::string> &inOutGlslCodePerStage, std::string &outErrMsg, bool keepSpecializationConstants)
 {
 	std::vector<std::optional<prosper::IPrContext::ShaderDescriptorSetInfo>> descSetInfos {};
 	struct StageData {
@@ -19,9 +181,19 @@ bool prosper::util::convert_glsl_set_bindings_to_opengl_binding_points(std::vect
 		stages.push_back({});
 		auto &stageData = stages.back();
 		auto &definitions = stageData.definitions;
-
 		auto &macroLocations = stageData.macroLocations;
-		IPrContext::ParseShaderUniforms(inOutGlslCode, definitions, descSetInfos, macroLocations);
+		if(keepSpecializationConstants == false) {
+			strip_constant_id_layouts(inOutGlslCode);
+			IPrContext::ParseShaderUniforms(inOutGlslCode, definitions, descSetInfos, macroLocations);
+			continue;
+		}
+		// The uniforms are parsed without the specialization constant layouts, so
+		// the macro locations have to be mapped back to the original code.
+		auto strippedGlslCode = inOutGlslCode;
+		std::vector<std::pair<size_t, size_t>> removedRanges;
+		strip_constant_id_layouts(strippedGlslCode, &removedRanges);
+		IPrContext::ParseShaderUniforms(strippedGlslCode, definitions, descSetInfos, macroLocations);
+		map_to_original_positions(macroLocations, removedRanges);
 	}
 
 	uint32_t descSetIdx = 0;
@@ -48,18 +220,15 @@ bool prosper::util::convert_glsl_set_bindings_to_opengl_binding_points(std::vect
 	}
 
 	// Apply binding points to GLSL shader code
+	std::vector<GlslEdit> edits;
 	uint32_t stageIdx = 0;
 	for(auto &stageData : stages) {
 		auto &inOutGlslCode = inOutGlslCodePerStage.at(stageIdx++);
-		auto &newGlslShader = inOutGlslCode;
-		int64_t offset = 0;
-		for(auto &loc : stageData.macroLocations) {
-			auto strStart = loc.macroStart;
-			auto strEnd = loc.macroEnd;
-			auto oldLen = newGlslShader.length();
-			newGlslShader = newGlslShader.substr(0, strStart + offset) + "binding = " + pragma::util::to_string(descSetInfos.at(loc.setIndexIndex)->bindingPoints.at(loc.bindingIndexIndex).bindingPoint) + newGlslShader.substr(strEnd + offset);
-			offset += (newGlslShader.length() - oldLen);
-		}
+		edits.clear();
+		edits.reserve(stageData.macroLocations.size());
+		for(auto &loc : stageData.macroLocations)
+			edits.push_back({loc.macroStart, loc.macroEnd, descSetInfos.at(loc.setIndexIndex)->bindingPoints.at(loc.bindingIndexIndex).bindingPoint});
+		apply_edits(inOutGlslCode, edits);
 	}
 	return true;
 }
@@ -6,5 +6,13 @@ export module pragma.prosper.opengl:shader.post_processing;
 export import std;
 
 namespace prosper::util {
-	bool convert_glsl_set_bindings_to_opengl_binding_points(std::vector<std::string> &inOutGlslCodePerStage, std::string &outErrMsg);
+	// Rewrites the preprocessed Vulkan GLSL code of all stages of a shader for OpenGL:
+	// Specialization constant layouts are removed and descriptor set bindings are converted to OpenGL binding points.
+	// Each stage is rewritten in a single pass into one output buffer.
+	// Specialization constants can be kept if the code is compiled to SPIR-V for OpenGL or specialized with specialize_glsl.
+	bool rewrite_glsl_for_opengl(std::vector<std::string> &inOutGlslCodePerStage, std::string &outErrMsg, bool keepSpecializationConstants = false);
+	// Turns the specialization constants of code rewritten with keepSpecializationConstants into regular constants.
+	// Constants with a specified value are initialized with that value (interpreted according to the type of the constant),
+	// all others keep their default value. This allows the driver to constant-fold branches depending on them.
+	std::string specialize_glsl(const std::string &glslCode, std::span<const uint32_t> constantIds, std::span<const uint32_t> constantValues);
 };
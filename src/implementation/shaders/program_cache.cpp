@@ -0,0 +1,236 @@
+// SPDX-FileCopyrightText: (c) 2020 Silverlan <opensource@pragma-engine.com>
+// SPDX-License-Identifier: MIT
+
+module;
+
+#include "opengl_api.hpp"
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+module pragma.prosper.opengl;
+
+import :shader.program_cache;
+
+namespace {
+	constexpr std::array<char, 8> ARCHIVE_MAGIC {'P', 'R', 'G', 'L', 'P', 'B', 'I', 'N'};
+	constexpr uint32_t ARCHIVE_VERSION = 1;
+	struct ArchiveHeader {
+		std::array<char, 8> magic;
+		uint32_t version;
+		uint32_t entryCount;
+		uint64_t driverHash;
+	};
+	struct ArchiveEntry {
+		uint64_t key;
+		uint32_t format;
+		uint32_t padding;
+		uint64_t offset;
+		uint64_t size;
+	};
+};
+
+using namespace prosper;
+
+std::unique_ptr<GLProgramCache> GLProgramCache::Load(const std::string &path, const std::string &driverIdentifier)
+{
+	auto cache = std::unique_ptr<GLProgramCache> {new GLProgramCache {path, util::hash_fnv1a(driverIdentifier.data(), driverIdentifier.size())}};
+	// A missing or outdated archive isn't an error, the cache simply starts out empty
+	cache->Map();
+	return cache;
+}
+
+uint64_t GLProgramCache::CalcProgramKey(uint64_t programContentKey, uint64_t driverHash)
+{
+	auto hash = util::hash_fnv1a(&driverHash, sizeof(driverHash));
+	return util::hash_fnv1a(&programContentKey, sizeof(programContentKey), hash);
+}
+
+GLProgramCache::GLProgramCache(const std::string &path, uint64_t driverHash) : m_path {path}, m_driverHash {driverHash} {}
+
+GLProgramCache::~GLProgramCache() { Unmap(); }
+
+bool GLProgramCache::Map()
+{
+	Unmap();
+#ifdef _WIN32
+	auto hFile = CreateFileA(m_path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if(hFile == INVALID_HANDLE_VALUE)
+		return false;
+	LARGE_INTEGER fileSize;
+	if(GetFileSizeEx(hFile, &fileSize) == FALSE || fileSize.QuadPart < static_cast<LONGLONG>(sizeof(ArchiveHeader))) {
+		CloseHandle(hFile);
+		return false;
+	}
+	auto hMapping = CreateFileMappingA(hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	CloseHandle(hFile);
+	if(hMapping == nullptr)
+		return false;
+	auto *data = MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+	// The view keeps the mapping alive
+	CloseHandle(hMapping);
+	if(data == nullptr)
+		return false;
+	m_mappedData = static_cast<const uint8_t *>(data);
+	m_mappedSize = static_cast<size_t>(fileSize.QuadPart);
+#else
+	auto fd = open(m_path.c_str(), O_RDONLY);
+	if(fd == -1)
+		return false;
+	struct stat st;
+	if(fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(ArchiveHeader))) {
+		close(fd);
+		return false;
+	}
+	auto *data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	// The mapping stays valid after the file descriptor has been closed
+	close(fd);
+	if(data == MAP_FAILED)
+		return false;
+	m_mappedData = static_cast<const uint8_t *>(data);
+	m_mappedSize = static_cast<size_t>(st.st_size);
+#endif
+
+	ArchiveHeader header;
+	std::memcpy(&header, m_mappedData, sizeof(header));
+	if(header.magic != ARCHIVE_MAGIC || header.version != ARCHIVE_VERSION || header.driverHash != m_driverHash) {
+		// Binaries from a different driver would be rejected anyway
+		Unmap();
+		return false;
+	}
+	auto entryTableSize = static_cast<uint64_t>(header.entryCount) * sizeof(ArchiveEntry);
+	if(sizeof(ArchiveHeader) + entryTableSize > m_mappedSize) {
+		Unmap();
+		return false;
+	}
+	m_entries.reserve(header.entryCount);
+	for(auto i = decltype(header.entryCount) {0u}; i < header.entryCount; ++i) {
+		ArchiveEntry archiveEntry;
+		std::memcpy(&archiveEntry, m_mappedData + sizeof(ArchiveHeader) + i * sizeof(ArchiveEntry), sizeof(archiveEntry));
+		if(archiveEntry.offset > m_mappedSize || archiveEntry.size > m_mappedSize - archiveEntry.offset)
+			continue; // Truncated archive
+		auto &entry = m_entries[archiveEntry.key];
+		entry.format = archiveEntry.format;
+		entry.mappedData = m_mappedData + archiveEntry.offset;
+		entry.size = archiveEntry.size;
+	}
+	return true;
+}
+
+void GLProgramCache::Unmap()
+{
+	if(m_mappedData == nullptr)
+		return;
+	// Entries pointing into the mapped archive become invalid
+	for(auto it = m_entries.begin(); it != m_entries.end();) {
+		if(it->second.data.empty())
+			it = m_entries.erase(it);
+		else
+			++it;
+	}
+#ifdef _WIN32
+	UnmapViewOfFile(m_mappedData);
+#else
+	munmap(const_cast<uint8_t *>(m_mappedData), m_mappedSize);
+#endif
+	m_mappedData = nullptr;
+	m_mappedSize = 0;
+}
+
+std::optional<GLProgramCache::Binary> GLProgramCache::Find(uint64_t key) const
+{
+	auto it = m_entries.find(key);
+	if(it == m_entries.end())
+		return {};
+	auto &entry = it->second;
+	Binary binary {};
+	binary.format = entry.format;
+	binary.data = entry.data.empty() ? entry.mappedData : entry.data.data();
+	binary.size = entry.size;
+	return binary;
+}
+
+void GLProgramCache::Store(uint64_t key, GLenum format, std::vector<uint8_t> &&data)
+{
+	auto &entry = m_entries[key];
+	entry.format = format;
+	entry.size = data.size();
+	entry.data = std::move(data);
+	entry.mappedData = nullptr;
+	m_dirty = true;
+}
+
+void GLProgramCache::Remove(uint64_t key)
+{
+	if(m_entries.erase(key) > 0)
+		m_dirty = true;
+}
+
+bool GLProgramCache::Save()
+{
+	if(!m_dirty)
+		return true;
+	std::error_code ec;
+	auto path = std::filesystem::path {m_path};
+	if(path.has_parent_path())
+		std::filesystem::create_directories(path.parent_path(), ec);
+
+	// Write to a temporary file first, so an interrupted write can't corrupt the existing archive
+	auto tmpPath = path;
+	tmpPath += ".tmp";
+	{
+		std::ofstream f {tmpPath, std::ios::binary | std::ios::trunc};
+		if(!f)
+			return false;
+		ArchiveHeader header {};
+		header.magic = ARCHIVE_MAGIC;
+		header.version = ARCHIVE_VERSION;
+		header.entryCount = static_cast<uint32_t>(m_entries.size());
+		header.driverHash = m_driverHash;
+		f.write(reinterpret_cast<const char *>(&header), sizeof(header));
+
+		auto offset = static_cast<uint64_t>(sizeof(ArchiveHeader) + m_entries.size() * sizeof(ArchiveEntry));
+		for(auto &[key, entry] : m_entries) {
+			ArchiveEntry archiveEntry {};
+			archiveEntry.key = key;
+			archiveEntry.format = entry.format;
+			archiveEntry.offset = offset;
+			archiveEntry.size = entry.size;
+			f.write(reinterpret_cast<const char *>(&archiveEntry), sizeof(archiveEntry));
+			offset += entry.size;
+		}
+		for(auto &[key, entry] : m_entries) {
+			auto *data = entry.data.empty() ? entry.mappedData : entry.data.data();
+			f.write(reinterpret_cast<const char *>(data), entry.size);
+		}
+		if(!f)
+			return false;
+	}
+
+	// The archive can't be replaced while it's mapped (on Windows). The mapped binaries are copied first,
+	// so they're still available (and written by the next Save) if the archive can't be replaced.
+	for(auto &[key, entry] : m_entries) {
+		if(entry.data.empty() == false)
+			continue;
+		entry.data.assign(entry.mappedData, entry.mappedData + entry.size);
+		entry.mappedData = nullptr;
+	}
+	Unmap();
+	std::filesystem::rename(tmpPath, path, ec);
+	if(ec) {
+		std::filesystem::remove(tmpPath, ec);
+		return false;
+	}
+	// The new archive contains all entries, so the copies can be replaced by the mapping
+	m_entries.clear();
+	m_dirty = false;
+	Map();
+	return true;
+}
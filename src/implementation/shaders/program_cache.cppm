@@ -0,0 +1,54 @@
+// SPDX-FileCopyrightText: (c) 2020 Silverlan <opensource@pragma-engine.com>
+// SPDX-License-Identifier: MIT
+
+module;
+
+#include "opengl_api.hpp"
+
+export module pragma.prosper.opengl:shader.program_cache;
+
+export import std;
+
+namespace prosper {
+	// On-disk cache of linked program binaries (glGetProgramBinary/glProgramBinary).
+	// All binaries are stored in a single archive file, which is memory-mapped on load.
+	// The archive is discarded as a whole if it was written by a different driver.
+	class GLProgramCache {
+	  public:
+		struct Binary {
+			GLenum format = GL_NONE;
+			const uint8_t *data = nullptr;
+			size_t size = 0;
+		};
+		static std::unique_ptr<GLProgramCache> Load(const std::string &path, const std::string &driverIdentifier);
+		// Program key for the content key of a program (derived from the code and specialization of all of its stages)
+		static uint64_t CalcProgramKey(uint64_t programContentKey, uint64_t driverHash);
+		~GLProgramCache();
+
+		uint64_t GetDriverHash() const { return m_driverHash; }
+		std::optional<Binary> Find(uint64_t key) const;
+		void Store(uint64_t key, GLenum format, std::vector<uint8_t> &&data);
+		void Remove(uint64_t key);
+		bool IsDirty() const { return m_dirty; }
+		bool Save();
+	  private:
+		GLProgramCache(const std::string &path, uint64_t driverHash);
+		bool Map();
+		void Unmap();
+
+		struct Entry {
+			GLenum format = GL_NONE;
+			// Either points into the mapped archive or into 'data'
+			const uint8_t *mappedData = nullptr;
+			size_t size = 0;
+			std::vector<uint8_t> data;
+		};
+		std::string m_path;
+		uint64_t m_driverHash = 0;
+		std::unordered_map<uint64_t, Entry> m_entries;
+		bool m_dirty = false;
+
+		const uint8_t *m_mappedData = nullptr;
+		size_t m_mappedSize = 0;
+	};
+};
@@ -0,0 +1,141 @@
+// SPDX-FileCopyrightText: (c) 2020 Silverlan <opensource@pragma-engine.com>
+// SPDX-License-Identifier: MIT
+
+module pragma.prosper.opengl;
+
+import :shader.usage_profile;
+
+namespace {
+	constexpr std::array<char, 8> PROFILE_MAGIC {'P', 'R', 'G', 'L', 'P', 'U', 'S', 'E'};
+	constexpr uint32_t PROFILE_VERSION = 1;
+	struct ProfileHeader {
+		std::array<char, 8> magic;
+		uint32_t version;
+		uint32_t entryCount;
+		uint64_t shaderSetHash;
+	};
+	// Followed by the shader identifier
+	struct ProfileEntry {
+		uint64_t stageKey;
+		uint32_t shaderPipelineIdx;
+		uint32_t firstBindTime;
+		uint32_t shaderIdentifierLength;
+		uint32_t padding;
+	};
+};
+
+using namespace prosper;
+
+std::unique_ptr<GLPipelineUsageProfile> GLPipelineUsageProfile::Load(const std::string &path, uint64_t shaderSetHash)
+{
+	auto profile = std::unique_ptr<GLPipelineUsageProfile> {new GLPipelineUsageProfile {path, shaderSetHash}};
+	// A missing or outdated profile isn't an error, the link order is simply not known in advance
+	profile->Read();
+	return profile;
+}
+
+GLPipelineUsageProfile::GLPipelineUsageProfile(const std::string &path, uint64_t shaderSetHash) : m_path {path}, m_shaderSetHash {shaderSetHash}, m_sessionStart {std::chrono::steady_clock::now()} {}
+
+uint64_t GLPipelineUsageProfile::CalcEntryKey(const std::string &shaderIdentifier, uint32_t shaderPipelineIdx)
+{
+	auto hash = util::hash_fnv1a(shaderIdentifier.data(), shaderIdentifier.size());
+	return util::hash_fnv1a(&shaderPipelineIdx, sizeof(shaderPipelineIdx), hash);
+}
+
+void GLPipelineUsageProfile::Read()
+{
+	std::ifstream f {m_path, std::ios::binary};
+	if(!f)
+		return;
+	ProfileHeader header;
+	if(!f.read(reinterpret_cast<char *>(&header), sizeof(header)))
+		return;
+	if(header.magic != PROFILE_MAGIC || header.version != PROFILE_VERSION || header.shaderSetHash != m_shaderSetHash)
+		return;
+	m_previousSession.reserve(header.entryCount);
+	for(auto i = decltype(header.entryCount) {0u}; i < header.entryCount; ++i) {
+		ProfileEntry profileEntry;
+		if(!f.read(reinterpret_cast<char *>(&profileEntry), sizeof(profileEntry)))
+			break; // Truncated profile
+		Entry entry {};
+		entry.shaderIdentifier.resize(profileEntry.shaderIdentifierLength);
+		if(!f.read(entry.shaderIdentifier.data(), entry.shaderIdentifier.size()))
+			break;
+		entry.shaderPipelineIdx = profileEntry.shaderPipelineIdx;
+		entry.stageKey = profileEntry.stageKey;
+		entry.firstBindTime = profileEntry.firstBindTime;
+		auto key = CalcEntryKey(entry.shaderIdentifier, entry.shaderPipelineIdx);
+		m_previousSession[key] = std::move(entry);
+	}
+}
+
+std::optional<uint32_t> GLPipelineUsageProfile::FindFirstBindTime(const std::string &shaderIdentifier, uint32_t shaderPipelineIdx, uint64_t stageKey) const
+{
+	auto it = m_previousSession.find(CalcEntryKey(shaderIdentifier, shaderPipelineIdx));
+	if(it == m_previousSession.end() || it->second.stageKey != stageKey || it->second.shaderIdentifier != shaderIdentifier)
+		return {};
+	return it->second.firstBindTime;
+}
+
+void GLPipelineUsageProfile::RecordFirstBind(const std::string &shaderIdentifier, uint32_t shaderPipelineIdx, uint64_t stageKey)
+{
+	if(m_recordedEntries.insert(CalcEntryKey(shaderIdentifier, shaderPipelineIdx)).second == false)
+		return;
+	auto t = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - m_sessionStart).count();
+	m_currentSession.push_back({shaderIdentifier, shaderPipelineIdx, stageKey, static_cast<uint32_t>(std::min<int64_t>(t, std::numeric_limits<uint32_t>::max()))});
+}
+
+bool GLPipelineUsageProfile::Save() const
+{
+	if(m_currentSession.empty())
+		return true;
+	// Pipelines that weren't bound in this session keep their entry from the previous one, unless their code has changed
+	auto entries = m_previousSession;
+	for(auto &entry : m_currentSession) {
+		auto [it, inserted] = entries.insert({CalcEntryKey(entry.shaderIdentifier, entry.shaderPipelineIdx), entry});
+		if(inserted)
+			continue;
+		auto &prevEntry = it->second;
+		if(prevEntry.stageKey != entry.stageKey || prevEntry.shaderIdentifier != entry.shaderIdentifier)
+			prevEntry = entry;
+		else
+			prevEntry.firstBindTime = std::min(prevEntry.firstBindTime, entry.firstBindTime);
+	}
+
+	std::error_code ec;
+	auto path = std::filesystem::path {m_path};
+	if(path.has_parent_path())
+		std::filesystem::create_directories(path.parent_path(), ec);
+
+	// Write to a temporary file first, so an interrupted write can't corrupt the existing profile
+	auto tmpPath = path;
+	tmpPath += ".tmp";
+	{
+		std::ofstream f {tmpPath, std::ios::binary | std::ios::trunc};
+		if(!f)
+			return false;
+		ProfileHeader header {};
+		header.magic = PROFILE_MAGIC;
+		header.version = PROFILE_VERSION;
+		header.entryCount = static_cast<uint32_t>(entries.size());
+		header.shaderSetHash = m_shaderSetHash;
+		f.write(reinterpret_cast<const char *>(&header), sizeof(header));
+		for(auto &[key, entry] : entries) {
+			ProfileEntry profileEntry {};
+			profileEntry.stageKey = entry.stageKey;
+			profileEntry.shaderPipelineIdx = entry.shaderPipelineIdx;
+			profileEntry.firstBindTime = entry.firstBindTime;
+			profileEntry.shaderIdentifierLength = static_cast<uint32_t>(entry.shaderIdentifier.size());
+			f.write(reinterpret_cast<const char *>(&profileEntry), sizeof(profileEntry));
+			f.write(entry.shaderIdentifier.data(), entry.shaderIdentifier.size());
+		}
+		if(!f)
+			return false;
+	}
+	std::filesystem::rename(tmpPath, path, ec);
+	if(ec) {
+		std::filesystem::remove(tmpPath, ec);
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,43 @@
+// SPDX-FileCopyrightText: (c) 2020 Silverlan <opensource@pragma-engine.com>
+// SPDX-License-Identifier: MIT
+
+export module pragma.prosper.opengl:shader.usage_profile;
+
+export import std;
+
+namespace prosper {
+	// Records which pipelines are bound during a session and when they were bound for the first time.
+	// The profile of the previous session determines the order in which pipelines are compiled and linked, so the pipelines
+	// that are needed first are ready first. Profiles recorded with a different shader set are discarded.
+	class GLPipelineUsageProfile {
+	  public:
+		struct Entry {
+			std::string shaderIdentifier;
+			uint32_t shaderPipelineIdx = 0;
+			// Hash of the stages of the pipeline, entries of pipelines whose code has changed are ignored
+			uint64_t stageKey = 0;
+			// Milliseconds since the start of the session
+			uint32_t firstBindTime = 0;
+		};
+		static std::unique_ptr<GLPipelineUsageProfile> Load(const std::string &path, uint64_t shaderSetHash);
+
+		bool HasPreviousSession() const { return m_previousSession.empty() == false; }
+		// Returns the first bind time of the pipeline in the previous session
+		std::optional<uint32_t> FindFirstBindTime(const std::string &shaderIdentifier, uint32_t shaderPipelineIdx, uint64_t stageKey) const;
+		void RecordFirstBind(const std::string &shaderIdentifier, uint32_t shaderPipelineIdx, uint64_t stageKey);
+		// Writes the current session merged with the previous one (keeping the earlier bind time of pipelines bound in both),
+		// unless nothing has been recorded
+		bool Save() const;
+	  private:
+		GLPipelineUsageProfile(const std::string &path, uint64_t shaderSetHash);
+		static uint64_t CalcEntryKey(const std::string &shaderIdentifier, uint32_t shaderPipelineIdx);
+		void Read();
+
+		std::string m_path;
+		uint64_t m_shaderSetHash = 0;
+		std::chrono::steady_clock::time_point m_sessionStart;
+		std::unordered_map<uint64_t, Entry> m_previousSession;
+		std::vector<Entry> m_currentSession;
+		std::unordered_set<uint64_t> m_recordedEntries;
+	};
+};
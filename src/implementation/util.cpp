@@ -171,6 +171,28 @@ GLenum prosper::util::to_opengl_enum(prosper::IndexType indexType)
 	return 0;
 }
 
+GLenum prosper::util::to_opengl_enum(prosper::ImageViewType imageViewType)
+{
+	switch(imageViewType) {
+	case ImageViewType::e1D:
+		return GL_TEXTURE_1D;
+	case ImageViewType::e2D:
+		return GL_TEXTURE_2D;
+	case ImageViewType::e3D:
+		return GL_TEXTURE_3D;
+	case ImageViewType::Cube:
+		return GL_TEXTURE_CUBE_MAP;
+	case ImageViewType::e1DArray:
+		return GL_TEXTURE_1D_ARRAY;
+	case ImageViewType::e2DArray:
+		return GL_TEXTURE_2D_ARRAY;
+	case ImageViewType::CubeArray:
+		return GL_TEXTURE_CUBE_MAP_ARRAY;
+	}
+	assert(false);
+	return 0;
+}
+
 GLenum prosper::util::to_opengl_image_format_type(prosper::Format format, GLboolean &outNormalized)
 {
 	outNormalized = GL_FALSE;
@@ -253,6 +275,42 @@ GLenum prosper::util::to_opengl_image_format_type(prosper::Format format, GLbool
 	throw std::logic_error {"Unsupported format!"};
 }
 
+bool prosper::util::has_stencil_component(prosper::Format format)
+{
+	switch(format) {
+	case prosper::Format::D16_UNorm_S8_UInt_PoorCoverage:
+	case prosper::Format::D24_UNorm_S8_UInt_PoorCoverage:
+	case prosper::Format::D32_SFloat_S8_UInt:
+		return true;
+	}
+	return false;
+}
+
+bool prosper::util::is_integer_pixel_data_format(GLenum pixelDataFormat)
+{
+	switch(pixelDataFormat) {
+	case GL_RED_INTEGER:
+	case GL_RG_INTEGER:
+	case GL_RGB_INTEGER:
+	case GL_BGR_INTEGER:
+	case GL_RGBA_INTEGER:
+	case GL_BGRA_INTEGER:
+		return true;
+	}
+	return false;
+}
+
+uint64_t prosper::util::hash_fnv1a(const void *data, size_t size, uint64_t hash)
+{
+	constexpr uint64_t fnvPrime = 1'099'511'628'211ull;
+	auto *bytes = static_cast<const uint8_t *>(data);
+	for(size_t i = 0; i < size; ++i) {
+		hash ^= bytes[i];
+		hash *= fnvPrime;
+	}
+	return hash;
+}
+
 GLenum prosper::util::to_opengl_image_format(prosper::Format format, GLenum *optOutPixelDataFormat)
 {
 	switch(format) {
@@ -9,8 +9,15 @@ export module pragma.prosper.opengl:command_buffer;
 
 export import pragma.prosper;
 
+namespace prosper {
+	class GLBufferUpdateBatch;
+};
+
 export namespace prosper {
 	class GLContext;
+	class GLRenderPass;
+	class GLFramebuffer;
+	class GLEvent;
 	class PR_EXPORT GLCommandBuffer : virtual public prosper::ICommandBuffer {
 	  public:
 		virtual ~GLCommandBuffer() override;
@@ -67,8 +74,29 @@ export namespace prosper {
 		virtual bool WriteTimestampQuery(const TimestampQuery &query) const override;
 		virtual bool ResetQuery(const Query &query) const override;
 		virtual bool RecordPresentImage(IImage &img, IImage &swapchainImg, IFramebuffer &swapchainFramebuffer) override;
+		// Places the signal point of the event after the commands recorded so far. The event is reset immediately.
+		bool RecordSignalEvent(GLEvent &ev);
 
 		GLContext &GetContext() const;
+
+		// If recording is deferred, commands are added to a list instead of being executed, which doesn't require the GL context.
+		// The list is executed with ReplayCommands on the GL thread.
+		using Command = std::function<bool(GLCommandBuffer &)>;
+		bool IsRecordingDeferred() const { return m_recordDeferred; }
+		// Moves the deferred commands out of the command buffer, recording is no longer deferred afterwards
+		std::vector<Command> TakeDeferredCommands() const;
+		bool ReplayDeferredCommands(GLCommandBuffer &cmd) const;
+		static bool ReplayCommands(const std::vector<Command> &commands, GLCommandBuffer &cmd);
+
+		// The completion fence is inserted when the command buffer is submitted and is discarded when recording starts again
+		void InsertCompletionFence() const;
+		bool HasCompletionFence() const { return m_completionFence != nullptr; }
+		// Waits until the commands submitted last have been executed by the GPU
+		bool WaitForCompletion(uint64_t timeout = std::numeric_limits<uint64_t>::max()) const;
+
+		// Between these calls RecordUpdateBuffer only copies the data, all updates are uploaded together by EndBufferUpdateBatch
+		void BeginBufferUpdateBatch();
+		bool EndBufferUpdateBatch();
 	  protected:
 		GLCommandBuffer(IPrContext &context, prosper::QueueFamilyType queueFamilyType);
 		void CheckViewportAndScissorBounds() const;
@@ -100,6 +128,19 @@ export namespace prosper {
 
 		std::array<int32_t, 4> m_viewport {};
 		std::array<int32_t, 4> m_scissor {};
+
+		// Flushes pending buffer updates, then records the command for replay on submission
+		bool Defer(Command &&cmd);
+		// Has to be called at the start of every command other than a buffer update. Returns true if the command
+		// has to be deferred (see Defer), otherwise flushes pending buffer updates so the command can be issued directly.
+		bool ShouldDefer();
+		// Uploads the updates batched so far
+		void FlushBufferUpdateBatch();
+		mutable bool m_recordDeferred = false;
+		mutable std::vector<Command> m_deferredCommands;
+		mutable GLsync m_completionFence = nullptr;
+		std::unique_ptr<GLBufferUpdateBatch> m_bufferUpdateBatch;
+		bool m_batchBufferUpdates = false;
 	};
 
 	class PR_EXPORT GLCommandBufferPool : public prosper::ICommandBufferPool {
@@ -116,7 +157,7 @@ export namespace prosper {
 		static std::shared_ptr<GLPrimaryCommandBuffer> Create(IPrContext &context, prosper::QueueFamilyType queueFamilyType);
 		virtual bool IsPrimary() const override;
 		virtual bool StopRecording() const override { return IPrimaryCommandBuffer::StopRecording() && GLCommandBuffer::StopRecording(); }
-		virtual bool ExecuteCommands(prosper::ISecondaryCommandBuffer &cmdBuf) { return true; }
+		virtual bool ExecuteCommands(prosper::ISecondaryCommandBuffer &cmdBuf);
 
 		// If no render pass is specified, the render target's render pass will be used
 		virtual bool StartRecording(bool oneTimeSubmit = true, bool simultaneousUseAllowed = false) const override;
@@ -125,10 +166,18 @@ export namespace prosper {
 		GLPrimaryCommandBuffer(IPrContext &context, prosper::QueueFamilyType queueFamilyType);
 		virtual bool DoRecordEndRenderPass() override;
 		virtual bool DoRecordBeginRenderPass(prosper::IImage &img, prosper::IRenderPass &rp, prosper::IFramebuffer &fb, uint32_t *layerId, const std::vector<prosper::ClearValue> &clearValues, RenderPassFlags renderPassFlags) override;
+	  private:
+		GLRenderPass *m_activeRenderPass = nullptr;
+		GLFramebuffer *m_activeFramebuffer = nullptr;
+		// Set if only a single layer of the framebuffer is rendered to
+		std::optional<uint32_t> m_activeLayerId {};
 	};
 
 	///////////////////
 
+	// Secondary command buffers don't issue any GL calls. Their commands are always deferred and
+	// are replayed on the GL thread by GLPrimaryCommandBuffer::ExecuteCommands, which allows
+	// secondary command buffers to be recorded on worker threads.
 	class PR_EXPORT GLSecondaryCommandBuffer : public GLCommandBuffer, public ISecondaryCommandBuffer {
 	  public:
 		static std::shared_ptr<GLSecondaryCommandBuffer> Create(IPrContext &context, prosper::QueueFamilyType queueFamilyType);
@@ -8,14 +8,51 @@ module;
 export module pragma.prosper.opengl:context;
 
 export import pragma.prosper;
+import :gpu_task;
 
 class GLShaderProgram;
+struct GLShaderStage;
+namespace prosper {
+	class GLProgramCache;
+	class GLPipelineUsageProfile;
+	class GLThread;
+	class GLBufferUpdateBatch;
+	class GLStagingBuffer;
+};
 export namespace prosper {
 	class ShaderBlit;
 	class GLBuffer;
+	class GLCommandBuffer;
 
 	class PR_EXPORT GLContext : public IPrContext {
 	  public:
+		// GL state of a graphics pipeline, resolved from its GraphicsPipelineCreateInfo when the pipeline is baked
+		struct PipelineState {
+			bool blendEnabled = false;
+			GLenum blendOpColor = GL_FUNC_ADD;
+			GLenum blendOpAlpha = GL_FUNC_ADD;
+			GLenum srcColorBlendFactor = GL_ONE;
+			GLenum dstColorBlendFactor = GL_ZERO;
+			GLenum srcAlphaBlendFactor = GL_ONE;
+			GLenum dstAlphaBlendFactor = GL_ZERO;
+			std::array<GLboolean, 4> colorMask {GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE};
+
+			bool cullFaceEnabled = false;
+			GLenum cullFace = GL_BACK;
+			GLenum frontFace = GL_CCW;
+			float lineWidth = 1.f;
+			bool depthBiasEnabled = false;
+
+			bool depthTestEnabled = false;
+			GLenum depthFunc = GL_LESS;
+			GLboolean depthMask = GL_TRUE;
+
+			// Static scissor and viewport, unset if they are dynamic
+			bool scissorTestEnabled = false;
+			std::optional<std::array<GLint, 4>> scissor {};
+			std::optional<std::array<GLint, 4>> viewport {};
+			std::array<float, 2> depthRange {0.f, 1.f};
+		};
 		static std::shared_ptr<GLContext> Create(const std::string &appName, bool bEnableValidation);
 		bool CheckFramebufferStatus(IFramebuffer &fb) const;
 		virtual bool IsImageFormatSupported(prosper::Format format, prosper::ImageUsageFlags usageFlags, prosper::ImageType type = prosper::ImageType::e2D, prosper::ImageTiling tiling = prosper::ImageTiling::Optimal) const override;
@@ -71,8 +108,28 @@ export namespace prosper {
 		virtual std::shared_ptr<ShaderStageProgram> CompileShader(prosper::ShaderStage stage, const std::string &shaderPath, std::string &outInfoLog, std::string &outDebugInfoLog, bool reload = false, const std::string &prefixCode = {},
 		  const std::unordered_map<std::string, std::string> &definitions = {}) override;
 		virtual bool GetParsedShaderSourceCode(prosper::Shader &shader, std::vector<std::string> &outGlslCodePerStage, std::vector<prosper::ShaderStage> &outGlslCodeStages, std::string &outInfoLog, std::string &outDebugInfoLog, prosper::ShaderStage &outErrStage) const override;
+		// The parsed source code is memoized per stage paths, prefix code and definitions.
+		// Cached results are discarded if the file time of a stage changes or if reload is set.
+		// Unlike the overload above, specialization constant layouts are kept (see util::specialize_glsl).
 		bool GetParsedShaderSourceCode(prosper::Shader &shader, std::vector<std::string> &outGlslCodePerStage, std::vector<prosper::ShaderStage> &outGlslCodeStages, std::string &outInfoLog, std::string &outDebugInfoLog, prosper::ShaderStage &outErrStage, const std::string &prefixCode,
-		  const std::unordered_map<std::string, std::string> &definitions) const;
+		  const std::unordered_map<std::string, std::string> &definitions, bool reload = false) const;
+		struct ShaderPreprocessInfo {
+			Shader *shader = nullptr;
+			std::string prefixCode;
+			std::unordered_map<std::string, std::string> definitions;
+		};
+		// Preprocesses the GLSL code of the shaders (loading, include resolution, uniform parsing and binding point conversion)
+		// on numThreads threads, or on all hardware threads if 0. This doesn't require the GL context. The results are memoized,
+		// so InitializeShaderSources only has to compile the stages afterwards.
+		// The shaders aren't modified, but prosper::glsl::load_glsl is called concurrently: It must only read from the context
+		// (the shader-specific definitions are passed in) and from the file system. Use a single thread if the context may be modified
+		// at the same time, e.g. by registering GLSL definitions or include paths.
+		// Returns the wall-clock time of the preprocessing. With reload set, memoized results are discarded, which allows
+		// measuring the load time for different thread counts.
+		std::chrono::nanoseconds PreprocessShaderSources(const std::vector<ShaderPreprocessInfo> &shaders, uint32_t numThreads = 0, bool reload = false) const;
+		// Startup benchmark: Preprocesses the shaders with 1 to maxThreads threads (all hardware threads if 0) and returns the load
+		// time for every thread count, the element at index i is the time for i +1 threads.
+		std::vector<std::chrono::nanoseconds> BenchmarkShaderPreprocessing(const std::vector<ShaderPreprocessInfo> &shaders, uint32_t maxThreads = 0) const;
 		//std::optional<std::string> CompileShaders(prosper::ShaderStage stage,const std::string &shaderPath,std::string &outInfoLog,std::string &outDebugInfoLog) const;
 		virtual bool InitializeShaderSources(prosper::Shader &shader, bool bReload, std::string &outInfoLog, std::string &outDebugInfoLog, prosper::ShaderStage &outErrStage, const std::string &prefixCode = {},
 		  const std::unordered_map<std::string, std::string> &definitions = {}) const override;
@@ -112,8 +169,133 @@ export namespace prosper {
 		bool CheckResult();
 		GLBuffer &GetPushConstantBuffer() const;
 		std::optional<GLuint> GetPipelineProgram(PipelineID pipelineId) const;
+		// Binds the program unless it is already bound. Pipelines with identical stages share their program.
+		void UseProgram(GLuint program);
+		// Pipelines are linked asynchronously if KHR_parallel_shader_compile is supported.
+		// Returns false while the pipeline is still being linked or if linking has failed, in which case
+		// the pipeline can't be bound yet and draw calls using it should be skipped (or use a fallback pipeline).
+		// If linking has failed, the error is written to outInfoLog once. Without outInfoLog it's reported through the validation callback.
+		bool IsPipelineReady(PipelineID pipelineId, std::string *outInfoLog = nullptr);
+		// Called when a pipeline is bound. Links the pipeline if linking has been deferred (see SetLazyPipelineLinkingEnabled)
+		// and returns whether it is ready to be used, see IsPipelineReady.
+		bool PreparePipelineForBind(PipelineID pipelineId, std::string *outInfoLog = nullptr);
 		std::optional<uint32_t> ShaderPipelineDescSetBindingIndexToBindingPoint(PipelineID pipelineId, uint32_t setIdx, uint32_t bindingIdx) const;
 		bool BindVertexBuffers(const prosper::GraphicsPipelineCreateInfo &pipelineCreateInfo, const std::vector<IBuffer *> &buffers, uint32_t startBinding, const std::vector<DeviceSize> &offsets, uint32_t *optOutAbsAttrId = nullptr);
+
+		// If enabled, glClipControl is used to match Vulkan's clip space conventions (upper-left origin, [0,1] depth range),
+		// which makes the coordinate transform in shaders unnecessary and allows presenting the image with a blit.
+		// Has to be set before the context is initialized and requires OpenGL 4.5.
+		void SetClipControlEnabled(bool enabled);
+		bool IsClipControlEnabled() const { return m_clipControlEnabled; }
+
+		// Location of the on-disk program binary cache, which is written by SavePipelineCache.
+		// Has to be set before the context is initialized, the cache is disabled by default (empty path).
+		void SetProgramCachePath(const std::string &path);
+
+		// Directory with precompiled SPIR-V shader stages (<stage key>.spv), which are used instead of the GLSL code if
+		// all stages of a shader are available. Requires OpenGL 4.6.
+		void SetSpirvShaderPath(const std::string &path);
+		// If set, the preprocessed GLSL code of all loaded shader stages is written to this directory (<stage key>.<stage>),
+		// with binding points remapped for OpenGL. These files can be compiled to SPIR-V for SetSpirvShaderPath with the
+		// prosper_opengl_precompile_spirv target.
+		void SetShaderSourceDumpPath(const std::string &path);
+
+		// Returns the baked state of a graphics pipeline, the pipeline is baked if it hasn't been yet.
+		const PipelineState *GetPipelineState(PipelineID pipelineId);
+		// Applies the state of a baked pipeline, except for the viewport and scissor, which are managed by the command buffer
+		void ApplyPipelineState(const PipelineState &state) const;
+		// If enabled, baking a graphics pipeline issues a draw call into a 1x1 off-screen framebuffer with an empty scissor,
+		// so drivers compile their internal shader variant for the pipeline state at load time instead of on first use.
+		void SetPipelineWarmUpEnabled(bool enabled) { m_pipelineWarmUpEnabled = enabled; }
+		bool IsPipelineWarmUpEnabled() const { return m_pipelineWarmUpEnabled; }
+
+		// If enabled, pipelines are not linked when they are created, but when they're bound for the first time or
+		// when they're taken from the link queue, which is processed for up to the idle link time budget after every frame.
+		// Pipelines with a higher link priority are linked first.
+		void SetLazyPipelineLinkingEnabled(bool enabled) { m_lazyPipelineLinkingEnabled = enabled; }
+		bool IsLazyPipelineLinkingEnabled() const { return m_lazyPipelineLinkingEnabled; }
+		void SetIdleLinkTimeBudget(std::chrono::microseconds budget) { m_idleLinkTimeBudget = budget; }
+		void SetPipelineLinkPriority(PipelineID pipelineId, int32_t priority);
+		struct PipelineUsageStats {
+			uint32_t numPipelines = 0;
+			uint32_t numLinked = 0;
+			uint32_t numPendingLink = 0;
+			uint32_t numUsed = 0;
+			uint32_t numNeverUsed = 0;
+		};
+		PipelineUsageStats GetPipelineUsageStats() const;
+
+		// Location of the pipeline usage profile, which records the pipelines bound in a session and is written by SavePipelineCache.
+		// The profile of the previous session is used as link priority (see SetLazyPipelineLinkingEnabled), so the pipelines bound first
+		// are compiled and linked first. Without lazy linking, the stages and pipelines created up to a frame are then compiled and
+		// linked all at once in that order after the frame (or when they're bound). shaderSetHash should identify the set of shaders shipped with the application,
+		// the profile is discarded if it changes.
+		// Has to be set before the context is initialized, an empty path disables the profile.
+		void SetPipelineUsageProfilePath(const std::string &path, uint64_t shaderSetHash = 0);
+
+		// Maximum number of frames the CPU may record ahead of the GPU. A fence is inserted after every frame, and
+		// DrawFrame waits for the fence of the frame that last used the same slot before it starts recording.
+		// Resources kept alive with KeepResourceAliveUntilPresentationComplete are released once that fence is signalled.
+		// The initial value is CreateInfo::maxNumberOfFramesInFlight.
+		void SetMaxFramesAhead(uint32_t count);
+		uint32_t GetMaxFramesAhead() const { return static_cast<uint32_t>(m_frameSlots.size()); }
+
+		// If enabled, the GL context is owned by a dedicated GL thread between frames. Command buffers are recorded without
+		// issuing GL calls, and the frame recorded in DrawFrame is executed and presented on the GL thread after DrawFrame has
+		// returned, so the driver work of a frame overlaps with whatever the caller does before the next frame.
+		// Resource creation, pipeline creation and queries, buffer mapping, fence waits and submissions are executed on the GL thread with
+		// a round-trip if they're called while the GL thread owns the context, any other GL work has to happen inside DrawFrame.
+		// Has to be called outside of DrawFrame, from the thread that owns the context.
+		void SetThreadedSubmissionEnabled(bool enabled);
+		bool IsThreadedSubmissionEnabled() const { return m_glThread != nullptr; }
+
+		// Number of times the entire GPU pipeline was drained with glFinish during the last frame. Flushing a command buffer only
+		// waits for that command buffer, so outside of WaitIdle this should be zero.
+		uint32_t GetPipelineDrainCount() const { return m_lastFramePipelineDrainCount; }
+
+		// GPU progress timeline: Every submission and every frame is assigned the next timeline value, which is
+		// completed once the GPU has finished executing it. Can be used from any thread without GL calls, e.g. to
+		// recycle pooled resources once the GPU no longer uses them.
+		// Value of the most recent submission, including submissions that are still queued for the GL thread
+		uint64_t GetSubmittedTimelineValue() const { return m_submittedTimelineValue.load(std::memory_order_acquire); }
+		uint64_t GetCompletedTimelineValue() const { return m_completedTimelineValue.load(std::memory_order_acquire); }
+		// Completion is observed whenever the GL thread submits or presents a frame, or immediately if
+		// called from the thread that owns the GL context. The timeout is in nanoseconds.
+		bool WaitTimelineValue(uint64_t value, uint64_t timeout = std::numeric_limits<uint64_t>::max()) const;
+
+		// Asynchronous GPU operations that can be awaited from a coroutine instead of polling fences. The data is copied by the time
+		// the function returns, the awaitable completes once the GPU has finished the operation.
+		GLGpuAwaitable<> AwaitTimelineValue(uint64_t value) { return {m_gpuScheduler, value}; }
+		// Completes once the submission that signals the fence has been executed (see GLFence::GetTimelineValue). If the fence
+		// hasn't been submitted yet, it completes with the next submission.
+		GLGpuAwaitable<> AwaitFence(const IFence &fence);
+		GLGpuAwaitable<bool> UploadAsync(IBuffer &buffer, uint64_t offset, uint64_t size, const void *data);
+		GLGpuAwaitable<bool> UploadAsync(IImage &img, uint64_t size, const void *data, uint32_t layerIndex = 0, uint32_t mipLevel = 0);
+		// The result is empty if the readback has failed
+		GLGpuAwaitable<std::vector<uint8_t>> ReadbackAsync(IBuffer &buffer, uint64_t offset, uint64_t size);
+		GLGpuAwaitable<std::vector<uint8_t>> ReadbackAsync(IImage &img, uint32_t layerIndex = 0, uint32_t mipLevel = 0);
+		// Resumes the coroutines of completed awaitables, called at the start of every frame.
+		// Has to be called from the thread that drives the frame loop.
+		void ResumeCompletedAwaiters();
+
+		// Uploads the updates through the staging buffer of the context, see GLCommandBuffer::BeginBufferUpdateBatch
+		bool UploadBufferUpdates(GLBufferUpdateBatch &batch);
+		// Returns true if the GL context is not current on the calling thread and GL calls have to go through RunOnGLThread
+		bool RequiresGLThreadRoundTrip() const;
+		// Executes the function on the GL thread and waits for the result, or executes it immediately if the context is current.
+		// While the context has been acquired by another thread (e.g. during DrawFrame), this waits until it has been handed back.
+		template<typename TFunc>
+		auto RunOnGLThread(TFunc &&func) const
+		{
+			using TResult = decltype(func());
+			if constexpr(std::is_void_v<TResult>)
+				ExecuteOnGLThread(func);
+			else {
+				std::optional<TResult> result {};
+				ExecuteOnGLThread([&func, &result]() { result.emplace(func()); });
+				return std::move(*result);
+			}
+		}
 	  protected:
 		GLContext(const std::string &appName, bool bEnableValidation = false);
 		virtual std::shared_ptr<IUniformResizableBuffer> DoCreateUniformResizableBuffer(const util::BufferCreateInfo &createInfo, uint64_t bufferInstanceSize, const void *data, prosper::DeviceSize bufferBaseSize, uint32_t alignment) override;
@@ -126,12 +308,51 @@ export namespace prosper {
 
 		virtual std::expected<void, std::string> InitAPI(const CreateInfo &createInfo) override;
 		void InitPushConstantBuffer();
+		void InitProgramCache();
+		void InitPipelineUsageProfile();
+		void WaitForFrameSlot(uint32_t slotIndex);
+		void InitParallelShaderCompile();
+		uint64_t GetShaderKeySeed() const;
+		void DumpShaderSourceCode(prosper::Shader &shader, const std::vector<std::string> &glslCodePerStage, const std::vector<prosper::ShaderStage> &glslCodeStages, const std::string &prefixCode, const std::unordered_map<std::string, std::string> &definitions) const;
 		void InitShaderPipeline(prosper::Shader &shader, PipelineID pipelineId, PipelineID shaderPipelineId);
+		bool BakePipelineState(PipelineID pipelineId);
+		bool LinkPipeline(PipelineID pipelineId);
+		void ProcessPipelineLinkQueue();
+		// Changes GL state, so it's postponed to the end of the frame if a frame is being recorded
+		void WarmUpPipeline(PipelineID pipelineId);
+		void ProcessPipelineWarmUpQueue();
+		void PresentFrame(uint32_t slotIndex);
+		// Executes the commands if recording was deferred and inserts the completion fence of the command buffer
+		void ExecuteCommandBuffer(GLCommandBuffer &cmd);
+		void ExecuteSubmission(ICommandBuffer &cmd, bool shouldBlock, IFence *fence);
+		void DrainPipeline();
+		// Has to be called before the submission is executed or handed to the GL thread
+		void ReserveTimelineValue();
+		// Inserts the sync object for the next reserved value and returns the value
+		uint64_t SignalTimeline();
+		// Updates the completed value from the signaled sync objects
+		void RetireTimelineSyncs(bool wait = false) const;
 	  private:
-		PipelineID AddPipeline(prosper::Shader &shader, PipelineID shaderPipelineId, std::shared_ptr<GLShaderProgram> program);
+		void ExecuteOnGLThread(const std::function<void()> &func) const;
+		// Moves the context from the GL thread to the calling thread, after the GL thread has completed all submitted work
+		void AcquireGLContext();
+		// Hands the context over to the GL thread
+		void ReleaseGLContext();
+		PipelineID AddPipeline(prosper::Shader &shader, PipelineID shaderPipelineId, std::shared_ptr<GLShaderProgram> program, std::vector<std::shared_ptr<GLShaderStage>> pendingStages, uint64_t stageKey);
 		struct PipelineData {
 			std::shared_ptr<GLShaderProgram> program = nullptr;
+			// Stages of a pipeline that hasn't been linked yet
+			std::vector<std::shared_ptr<GLShaderStage>> pendingStages {};
+			int32_t linkPriority = 0;
+			uint32_t bindCount = 0;
+			// Hash of the unspecialized stages, see GLPipelineUsageProfile
+			uint64_t stageKey = 0;
 			std::vector<std::vector<uint32_t>> descriptorSetBindingsToBindingPoints {};
+			pragma::util::WeakHandle<Shader> shader {};
+			PipelineID shaderPipelineId = 0;
+			std::optional<PipelineState> state {};
+			// Set if linking has failed and the error hasn't been reported by a bind yet
+			std::string linkError;
 		};
 		pragma::util::WeakHandle<Shader> m_hShaderBlit {};
 		pragma::util::WeakHandle<Shader> m_hShaderFlip {};
@@ -139,5 +360,76 @@ export namespace prosper {
 		std::vector<PipelineData> m_pipelines = {};
 		std::queue<size_t> m_freePipelineIndices {};
 		std::vector<std::shared_ptr<prosper::IFramebuffer>> m_swapchainFramebuffers {};
+		bool m_clipControlEnabled = false;
+		// If enabled, compile and link status queries are deferred until the driver reports completion
+		bool m_parallelShaderCompile = false;
+		std::string m_programCachePath;
+		std::unique_ptr<GLProgramCache> m_programCache;
+		std::string m_pipelineUsageProfilePath;
+		uint64_t m_shaderSetHash = 0;
+		std::unique_ptr<GLPipelineUsageProfile> m_pipelineUsageProfile;
+		std::string m_spirvShaderPath;
+		std::string m_shaderSourceDumpPath;
+		bool m_pipelineWarmUpEnabled = false;
+		bool m_lazyPipelineLinkingEnabled = false;
+		// True if pipelines are added to the link queue instead of being linked immediately
+		bool IsPipelineLinkingDeferred() const;
+		std::chrono::microseconds m_idleLinkTimeBudget {2'000};
+		// Ordered by descending link priority, then by pipeline id
+		std::set<std::pair<int32_t, PipelineID>> m_pipelineLinkQueue;
+		GLuint m_activeProgram = 0;
+
+		struct FrameSlot {
+			// Inserted after the frame has been presented
+			GLsync fence = nullptr;
+			std::vector<std::shared_ptr<void>> keepAliveResources;
+		};
+		std::vector<FrameSlot> m_frameSlots {1};
+		uint32_t m_frameSlotIndex = 0;
+		std::unique_ptr<GLThread> m_glThread;
+		// Set while the context is current on a thread other than the GL thread
+		bool m_glContextAcquired = false;
+		mutable std::mutex m_glContextMutex;
+		mutable std::condition_variable m_glContextCondition;
+		std::unique_ptr<GLStagingBuffer> m_stagingBuffer;
+
+		struct TimelineSync {
+			uint64_t value = 0;
+			GLsync sync = nullptr;
+		};
+		// Only accessed by the thread that owns the GL context
+		mutable std::deque<TimelineSync> m_timelineSyncs;
+		uint64_t m_signaledTimelineValue = 0;
+		std::atomic<uint64_t> m_submittedTimelineValue = 0;
+		mutable std::atomic<uint64_t> m_completedTimelineValue = 0;
+		mutable std::mutex m_timelineMutex;
+		mutable std::condition_variable m_timelineCondition;
+		GLGpuScheduler m_gpuScheduler {m_completedTimelineValue};
+		std::atomic<uint32_t> m_pipelineDrainCount = 0;
+		std::atomic<uint32_t> m_lastFramePipelineDrainCount = 0;
+
+		// Compiled stages and linked programs by content key, see GLShaderStage::GetContentKey
+		mutable std::unordered_map<uint64_t, std::weak_ptr<GLShaderStage>> m_sharedShaderStages;
+		mutable std::mutex m_sharedShaderStagesMutex;
+		std::unordered_map<uint64_t, std::weak_ptr<GLShaderProgram>> m_sharedPrograms;
+		GLuint m_warmUpFramebuffer = 0;
+		std::array<GLuint, 2> m_warmUpRenderbuffers {};
+		GLuint m_warmUpVertexArray = 0;
+		std::vector<PipelineID> m_pipelineWarmUpQueue;
+
+		struct ParsedShaderSource {
+			// Code with specialization constants kept
+			std::vector<std::string> glslCodePerStage;
+			// Code with the default values of the specialization constants, empty for stages without specialization constants
+			std::vector<std::string> defaultGlslCodePerStage;
+			std::vector<prosper::ShaderStage> glslCodeStages;
+			std::vector<uint64_t> contentKeys;
+			std::vector<std::pair<std::string, std::optional<std::filesystem::file_time_type>>> fileTimes;
+		};
+		bool GetPreprocessedShaderSources(prosper::Shader &shader, ParsedShaderSource &outSource, std::string &outInfoLog, std::string &outDebugInfoLog, prosper::ShaderStage &outErrStage, const std::string &prefixCode,
+		  const std::unordered_map<std::string, std::string> &definitions, bool reload) const;
+		bool LoadSpirvShaderStages(prosper::Shader &shader, const ParsedShaderSource &source, const std::string &prefixCode, const std::unordered_map<std::string, std::string> &definitions) const;
+		mutable std::unordered_map<uint64_t, ParsedShaderSource> m_parsedShaderSourceCache;
+		mutable std::mutex m_parsedShaderSourceCacheMutex;
 	};
 };
@@ -1,18 +1,35 @@
 // SPDX-FileCopyrightText: (c) 2020 Silverlan <opensource@pragma-engine.com>
 // SPDX-License-Identifier: MIT
 
+module;
+
+#include "opengl_api.hpp"
+
 export module pragma.prosper.opengl:event;
 
 export import pragma.prosper;
 
 export namespace prosper {
+	// Events are backed by a sync object. Since GL commands are executed as they are recorded, signalling an event
+	// places a signal point after all commands recorded so far, which is set once the GPU has passed it.
 	class PR_EXPORT GLEvent : public prosper::IEvent {
 	  public:
 		static std::shared_ptr<IEvent> Create(IPrContext &context);
 
 		virtual ~GLEvent() override;
+		// Non-blocking
 		virtual bool IsSet() const override;
+		// Places the signal point after all GL commands issued so far. Commands of command buffers with deferred recording
+		// (see GLCommandBuffer::IsRecordingDeferred) haven't been issued yet, use GLCommandBuffer::RecordSignalEvent for those.
+		void Signal();
+		// Doesn't issue any GL calls (the sync object is released through the deletion queue), so it can be called from any thread
+		void Reset();
+		// Waits for up to timeout nanoseconds, returns Result::Timeout if the event hasn't been set by then
+		Result Wait(uint64_t timeout = std::numeric_limits<uint64_t>::max()) const;
 	  private:
 		GLEvent(IPrContext &context);
+		// Accessed by the recording threads (see Reset) and the GL thread
+		mutable std::atomic<GLsync> m_sync = nullptr;
+		mutable std::atomic<bool> m_set = false;
 	};
 };
@@ -17,11 +17,19 @@ export namespace prosper {
 		virtual ~GLFence() override;
 		virtual bool IsSet() const override;
 		virtual bool Reset() const override;
-		void Wait();
+		// Waits for up to timeout nanoseconds, returns Result::Timeout if the fence hasn't been signalled by then
+		Result Wait(uint64_t timeout = std::numeric_limits<uint64_t>::max()) const;
+		// Returns immediately with Result::Success if the fence has been signalled, or Result::Timeout otherwise
+		Result Poll() const { return Wait(0); }
 		virtual const void *GetInternalHandle() const override { return m_fence; }
+		// Timeline value of the submission that signals the fence (see GLContext::GetCompletedTimelineValue),
+		// or 0 if the fence hasn't been submitted since it was last reset. Can be queried from any thread.
+		uint64_t GetTimelineValue() const { return m_timelineValue.load(std::memory_order_acquire); }
+		void SetTimelineValue(uint64_t value) const { m_timelineValue.store(value, std::memory_order_release); }
 	  private:
 		void Clear() const;
 		GLFence(IPrContext &context);
 		mutable GLsync m_fence = nullptr;
+		mutable std::atomic<uint64_t> m_timelineValue = 0;
 	};
 };
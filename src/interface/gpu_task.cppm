@@ -0,0 +1,86 @@
+// SPDX-FileCopyrightText: (c) 2020 Silverlan <opensource@pragma-engine.com>
+// SPDX-License-Identifier: MIT
+
+export module pragma.prosper.opengl:gpu_task;
+
+export import pragma.prosper;
+
+export namespace prosper {
+	// Keeps track of coroutines that are suspended until the GPU has reached a timeline value (see GLContext::GetCompletedTimelineValue).
+	// The coroutines are resumed by GLContext::ResumeCompletedAwaiters, which is called at the start of every frame.
+	class PR_EXPORT GLGpuScheduler {
+	  public:
+		GLGpuScheduler(const std::atomic<uint64_t> &completedValue) : m_completedValue {completedValue} {}
+		bool IsComplete(uint64_t value) const { return m_completedValue.load(std::memory_order_acquire) >= value; }
+		// Returns false if the value has already been completed, in which case the coroutine must not be suspended
+		bool Suspend(uint64_t value, std::coroutine_handle<> handle)
+		{
+			std::scoped_lock lock {m_mutex};
+			if(IsComplete(value))
+				return false;
+			m_awaiters.push_back({value, handle});
+			return true;
+		}
+		// Resumes all coroutines whose value has been completed, coroutines may suspend again while being resumed
+		void Resume()
+		{
+			std::vector<std::coroutine_handle<>> handles;
+			{
+				std::scoped_lock lock {m_mutex};
+				auto it = std::partition(m_awaiters.begin(), m_awaiters.end(), [this](const Awaiter &awaiter) { return !IsComplete(awaiter.value); });
+				handles.reserve(m_awaiters.end() - it);
+				for(auto itAwaiter = it; itAwaiter != m_awaiters.end(); ++itAwaiter)
+					handles.push_back(itAwaiter->handle);
+				m_awaiters.erase(it, m_awaiters.end());
+			}
+			for(auto &handle : handles)
+				handle.resume();
+		}
+		// Destroys the coroutines that are still suspended, called when the context is destroyed
+		void Clear()
+		{
+			std::vector<Awaiter> awaiters;
+			{
+				std::scoped_lock lock {m_mutex};
+				awaiters = std::move(m_awaiters);
+				m_awaiters.clear();
+			}
+			for(auto &awaiter : awaiters)
+				awaiter.handle.destroy();
+		}
+	  private:
+		struct Awaiter {
+			uint64_t value;
+			std::coroutine_handle<> handle;
+		};
+		const std::atomic<uint64_t> &m_completedValue;
+		std::mutex m_mutex;
+		std::vector<Awaiter> m_awaiters;
+	};
+
+	// Result of an asynchronous GPU operation that can be awaited with co_await, e.g. "auto data = co_await context.ReadbackAsync(img);".
+	// The result is retrieved when the coroutine is resumed, which happens on the thread that owns the GL context.
+	template<typename T = void>
+	class GLGpuAwaitable {
+	  public:
+		using ResultFunction = std::function<T()>;
+		GLGpuAwaitable(GLGpuScheduler &scheduler, uint64_t timelineValue, ResultFunction result = {}) : m_scheduler {&scheduler}, m_timelineValue {timelineValue}, m_result {std::move(result)} {}
+		uint64_t GetTimelineValue() const { return m_timelineValue; }
+
+		bool await_ready() const { return m_scheduler->IsComplete(m_timelineValue); }
+		bool await_suspend(std::coroutine_handle<> handle) const { return m_scheduler->Suspend(m_timelineValue, handle); }
+		T await_resume() const
+		{
+			if constexpr(std::is_void_v<T>) {
+				if(m_result)
+					m_result();
+			}
+			else
+				return m_result ? m_result() : T {};
+		}
+	  private:
+		GLGpuScheduler *m_scheduler = nullptr;
+		uint64_t m_timelineValue = 0;
+		ResultFunction m_result;
+	};
+};
@@ -18,6 +18,10 @@ export namespace prosper {
 		static std::shared_ptr<IImage> Create(IPrContext &context, const util::ImageCreateInfo &createInfo, const std::function<const uint8_t *(uint32_t layer, uint32_t mipmap, uint32_t &dataSize, uint32_t &rowSize)> &getImageData);
 		static GLenum GetImageType(const util::ImageCreateInfo &createInfo);
 		static bool IsLayered(const util::ImageCreateInfo &createInfo);
+		static uint32_t GetSampleCount(const util::ImageCreateInfo &createInfo);
+		// Multisampled images that are only used as attachments don't need to be sampled,
+		// so they're backed by a renderbuffer instead of a texture
+		static bool ShouldUseRenderbuffer(const util::ImageCreateInfo &createInfo);
 
 		virtual ~GLImage() override;
 		virtual std::optional<util::SubresourceLayout> GetSubresourceLayout(uint32_t layerId = 0, uint32_t mipMapIdx = 0) override;
@@ -32,9 +36,20 @@ export namespace prosper {
 		GLenum GetImageType() const;
 		GLenum GetImageType(uint32_t layerIndex) const;
 		GLuint GetGLImage() const { return m_image; }
+		GLuint GetGLRenderbuffer() const { return m_renderbuffer; }
+		bool IsRenderbuffer() const { return m_renderbuffer != 0; }
+		bool IsSwapchainImage() const { return m_image == 0 && m_renderbuffer == 0; }
+		bool IsMultisampled() const;
+		// If set, the image contents will be invalidated after they have been resolved.
+		// This is the case for multisampled attachments with a don't-care store op.
+		void SetInvalidateAfterResolve(bool invalidate) { m_invalidateAfterResolve = invalidate; }
+		bool ShouldInvalidateAfterResolve() const { return m_invalidateAfterResolve; }
 		GLenum GetPixelDataFormat() const { return m_pixelDataFormat; }
 		bool IsLayered() const;
 		std::shared_ptr<GLFramebuffer> GetOrCreateFramebuffer(uint32_t baseLayerId, uint32_t layerCount, uint32_t baseMipmap, uint32_t mipmapCount);
+		// Returns a texture view (see glTextureView) for the specified sub-range of this image.
+		// Views are cached and owned by the image, they are released when the image is destroyed.
+		GLuint GetOrCreateTextureView(GLenum target, GLenum internalFormat, uint32_t baseLayerId, uint32_t layerCount, uint32_t baseMipmap, uint32_t mipmapCount);
 	  private:
 		friend GLContext;
 		friend GLWindow;
@@ -42,9 +57,21 @@ export namespace prosper {
 		virtual bool DoSetMemoryBuffer(IBuffer &buffer) override;
 		void InitializeSubresourceLayouts();
 		GLuint m_image = GL_INVALID_VALUE;
+		GLuint m_renderbuffer = 0;
 		GLenum m_pixelDataFormat;
+		bool m_invalidateAfterResolve = false;
 
 		std::vector<std::shared_ptr<GLFramebuffer>> m_framebuffers;
+		struct TextureView {
+			GLenum target;
+			GLenum internalFormat;
+			uint32_t baseLayer;
+			uint32_t layerCount;
+			uint32_t baseMipmap;
+			uint32_t mipmapCount;
+			GLuint texture;
+		};
+		std::vector<TextureView> m_textureViews;
 		std::vector<std::vector<prosper::util::SubresourceLayout>> m_subresourceLayouts {};
 	};
 };
@@ -1,6 +1,10 @@
 // SPDX-FileCopyrightText: (c) 2020 Silverlan <opensource@pragma-engine.com>
 // SPDX-License-Identifier: MIT
 
+module;
+
+#include "opengl_api.hpp"
+
 export module pragma.prosper.opengl:image.view;
 
 export import pragma.prosper;
@@ -11,7 +15,13 @@ export namespace prosper {
 		static std::shared_ptr<IImageView> Create(IPrContext &context, IImage &img, const util::ImageViewCreateInfo &createInfo, ImageViewType type, ImageAspectFlags aspectFlags);
 
 		virtual ~GLImageView() override;
+		// Returns the OpenGL texture to bind for this view. If the view covers the entire image
+		// with the image's own type and format, this is the image texture itself, otherwise
+		// a texture view is created (and cached by the image) on first use.
+		GLuint GetGLTexture() const;
+		bool IsTextureView() const;
 	  private:
 		GLImageView(IPrContext &context, IImage &img, const util::ImageViewCreateInfo &createInfo, ImageViewType type, ImageAspectFlags aspectFlags);
+		mutable std::optional<GLuint> m_texture {};
 	};
 };
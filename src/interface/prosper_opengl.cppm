@@ -15,6 +15,7 @@ export import :descriptor_set_group;
 export import :event;
 export import :fence;
 export import :framebuffer;
+export import :gpu_task;
 export import :render_pass;
 export import :util;
 export import :window;
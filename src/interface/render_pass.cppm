@@ -1,17 +1,60 @@
 // SPDX-FileCopyrightText: (c) 2020 Silverlan <opensource@pragma-engine.com>
 // SPDX-License-Identifier: MIT
 
+module;
+
+#include "opengl_api.hpp"
+
 export module pragma.prosper.opengl:render_pass;
 
 export import pragma.prosper;
 
 export namespace prosper {
+	class GLFramebuffer;
 	class PR_EXPORT GLRenderPass : public prosper::IRenderPass {
 	  public:
 		static std::shared_ptr<IRenderPass> Create(IPrContext &context, const util::RenderPassCreateInfo &createInfo);
 
 		virtual ~GLRenderPass() override;
+
+		// Executes the attachment load ops (clears and invalidations) on the specified framebuffer
+		void RecordLoadOps(GLFramebuffer &framebuffer, const std::vector<prosper::ClearValue> &clearValues) const;
+		// Executes the attachment store ops (invalidations) on the specified framebuffer
+		void RecordStoreOps(GLFramebuffer &framebuffer) const;
+		// Same as above, but only for a single layer of the attachments (the framebuffer has all layers attached).
+		// Attachments that aren't backed by a texture (renderbuffers, swapchain images) are skipped.
+		void RecordLoadOps(GLFramebuffer &framebuffer, const std::vector<prosper::ClearValue> &clearValues, uint32_t layerId) const;
+		void RecordStoreOps(GLFramebuffer &framebuffer, uint32_t layerId) const;
 	  private:
 		GLRenderPass(IPrContext &context, const util::RenderPassCreateInfo &createInfo);
+		enum class ClearType : uint8_t {
+			ColorFloat = 0,
+			ColorInt,
+			ColorUInt,
+			Depth,
+			DepthStencil,
+		};
+		struct AttachmentClear {
+			uint32_t attachmentIndex = 0;
+			ClearType type = ClearType::ColorFloat;
+		};
+		struct AttachmentInvalidation {
+			uint32_t attachmentIndex = 0;
+			GLenum attachment = GL_NONE;
+			// The default framebuffer uses different attachment names
+			GLenum defaultFramebufferAttachment = GL_NONE;
+		};
+		static void Invalidate(GLFramebuffer &framebuffer, const std::vector<AttachmentInvalidation> &invalidations, bool skipMultisampled);
+		static void InvalidateLayer(GLFramebuffer &framebuffer, const std::vector<AttachmentInvalidation> &invalidations, uint32_t layerId, bool skipMultisampled);
+
+		std::vector<AttachmentClear> m_clears;
+		bool m_clearsColor = false;
+		bool m_clearsDepth = false;
+		bool m_clearsStencil = false;
+
+		// Attachments with load op DontCare are invalidated at the beginning of the render pass,
+		// attachments with store op DontCare at the end.
+		std::vector<AttachmentInvalidation> m_beginInvalidations;
+		std::vector<AttachmentInvalidation> m_endInvalidations;
 	};
 };
@@ -19,7 +19,12 @@ export namespace prosper {
 		PR_EXPORT GLenum to_opengl_enum(prosper::BlendOp blendOp);
 		PR_EXPORT GLenum to_opengl_enum(prosper::BlendFactor blendFactor);
 		PR_EXPORT GLenum to_opengl_enum(prosper::IndexType indexType);
+		PR_EXPORT GLenum to_opengl_enum(prosper::ImageViewType imageViewType);
 		PR_EXPORT GLenum to_opengl_image_format_type(prosper::Format format, GLboolean &outNormalized);
 		PR_EXPORT GLenum to_opengl_image_format(prosper::Format format, GLenum *optOutPixelDataFormat = nullptr);
+		PR_EXPORT bool has_stencil_component(prosper::Format format);
+		PR_EXPORT bool is_integer_pixel_data_format(GLenum pixelDataFormat);
+		// Stable (across runs and platforms) 64-bit FNV-1a hash, used for on-disk cache keys
+		PR_EXPORT uint64_t hash_fnv1a(const void *data, size_t size, uint64_t hash = 14'695'981'039'346'656'037ull);
 	};
 };